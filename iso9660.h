@@ -28,6 +28,12 @@ typedef char strD;
 #define HSF_PATH_SEPARATOR '/'
 
 #define HSF_SECTOR_SIZE 2048
+#define HSF_RAW_SECTOR_SIZE 2352
+
+// how the image stores each 2048-byte logical sector
+#define HSF_SECTOR_MODE_COOKED          0 // plain 2048-byte sectors (.iso)
+#define HSF_SECTOR_MODE_RAW_MODE1       1 // 2352-byte raw sectors, user data at offset 16
+#define HSF_SECTOR_MODE_RAW_MODE2_FORM1 2 // 2352-byte raw sectors, user data at offset 24
 
 #define HSF_VD_ID ("CD001")
 
@@ -163,6 +169,10 @@ typedef int (*hsf_read_sector_callback)(void *payload, void *buffer, u32 sector_
 
 typedef int (*hsf_write_sector_callback)(void *payload, void *buffer, u32 sector_start, u32 sector_count);
 
+typedef void *(*hsf_alloc_buffer_callback)(void *payload, u64 bytes);
+
+typedef void (*hsf_free_buffer_callback)(void *payload, void *buffer);
+
 
 #define HSF_IO_READ_ONLY  0
 #define HSF_IO_READ_WRITE 1
@@ -174,7 +184,13 @@ typedef struct
     hsf_write_sector_callback write_sector_cb;
     Hsf_Primary_Volume_Descriptor *pvd;
     
+    // optional, bulk reads land in buffers from these so a backend can hand out memory it can
+    // read into directly. HSF_ALLOC/HSF_FREE are used when they're not set.
+    hsf_alloc_buffer_callback alloc_buffer_cb;
+    hsf_free_buffer_callback free_buffer_cb;
+    
     int io_mode;
+    int sector_mode;
 } Hsf_Context;
 
 typedef struct
@@ -184,6 +200,20 @@ typedef struct
     u32 seek_position;
 } Hsf_File;
 
+typedef struct Hsf_Append_Dir Hsf_Append_Dir;
+
+typedef struct
+{
+    Hsf_Context *ctx;
+    u32 session_start;
+    u32 next_sector;
+    Hsf_Append_Dir *root;
+    
+    // the session time passed to hsf_append_begin, recorded on every record and as the PVD's
+    // modification date
+    Hsf_Time_Stamp time_stamp;
+} Hsf_Append;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -192,9 +222,40 @@ extern "C" {
     
 #ifdef HSF_INCLUDE_STDIO
     void hsf_create_from_fopen(Hsf_Context *ctx, const char *filename);
+    void hsf_create_from_fopen_with_mode(Hsf_Context *ctx, const char *filename, int io_mode);
     void hsf_destruct_with_fclose(Hsf_Context *ctx);
 #endif
     
+#ifdef HSF_INCLUDE_ODIRECT
+#define HSF_DIRECT_HUGE_PAGES (1 << 0) // try huge pages for the buffer pool
+    
+    // Linux only, define _GNU_SOURCE before including any system header. Opens the image
+    // read-only with O_DIRECT so bulk reads bypass the page cache. Buffers for the library's
+    // reads come from a pool of page-aligned mappings so they can be read into directly.
+    // hsf_file_read reads whole sectors straight into the caller's buffer; if that buffer and
+    // the position on the image are page-aligned they skip the bounce buffer too.
+    void hsf_create_from_open_direct(Hsf_Context *ctx, const char *filename, int flags);
+    void hsf_destruct_with_close_direct(Hsf_Context *ctx);
+#endif
+    
+#ifdef HSF_INCLUDE_DISK_CACHE
+    typedef struct Hsf_Disk_Cache Hsf_Disk_Cache;
+    
+    // POSIX only. Puts a cache on local disk in front of a slow read callback. The image is
+    // cached in 64 KiB chunks kept in max_bytes / 64 KiB slots (at least one) of the file at
+    // path, so it never grows past that; path.map records which chunk each slot holds. Slots
+    // are reused oldest first, and that order survives restarts along with the data. A cache
+    // that wasn't closed cleanly, was opened with a different max_bytes, or was filled from a
+    // different image is thrown away on open. Images are told apart by their newest session's
+    // PVD (volume id, size, root extent and dates), so appending a session drops the cache too;
+    // a source without a PVD gets an empty cache every time. Reads in the chunk that runs past
+    // the end of the image are passed straight through.
+    // Hand hsf_disk_cache_read_sector and the cache to hsf_create_context as the read callback.
+    Hsf_Disk_Cache *hsf_disk_cache_open(const char *path, hsf_read_sector_callback read_cb, void *read_payload, u64 max_bytes);
+    void hsf_disk_cache_close(Hsf_Disk_Cache *cache);
+    int hsf_disk_cache_read_sector(void *payload, void *buffer, u32 sector, u32 sector_count);
+#endif
+    
     void *hsf_get_sector(Hsf_Context *ctx, u32 Sector);
     Hsf_Primary_Volume_Descriptor *hsf_get_primary_volume_descriptor(Hsf_Context *ctx);
     Hsf_Directory_Entry *hsf_get_directory_entry(Hsf_Context *ctx, const char *filename);
@@ -213,6 +274,49 @@ extern "C" {
     typedef void (*hsf_visitor_callback)(Hsf_Context *ctx, const char *dir_path, Hsf_Directory_Entry *entry, void *user_payload);
     void hsf_visit_directory(Hsf_Context *ctx, const char *dir_path, hsf_visitor_callback visitor_cb, void *user_payload);
     
+#define HSF_WALK_ORDER_NONE 0
+#define HSF_WALK_ORDER_LBA  (1 << 0) // read directories in ascending LBA order where possible
+    
+    // Calls visitor_cb for every entry in the image ('.' and '..' excluded), following directory
+    // extents directly instead of resolving paths. With HSF_INCLUDE_PTHREADS directories are
+    // spread across thread_count workers, worker i passes thread_payloads[i] (or 0 if
+    // thread_payloads is 0) to visitor_cb; the callback and the context's read callback must be
+    // thread-safe in that case. Without it thread_count is ignored. Returns -1 if any directory
+    // could not be read, or if one is reached twice or nested deeper than HSF_WALK_MAX_DEPTH
+    // (a record pointing back up the tree); those aren't descended into.
+    int hsf_walk_tree(Hsf_Context *ctx, hsf_visitor_callback visitor_cb, void **thread_payloads, u32 thread_count, int flags);
+    
+    // Adds files to a HSF_IO_READ_WRITE context as a new session written after the last sector
+    // of the volume; nothing that's already on the image gets rewritten. File data is written by
+    // hsf_append_file as it's added. hsf_append_commit writes a new copy of every directory (so
+    // the session's tree is self-contained, old file extents are still shared), the path tables
+    // and a new PVD. Readers only see the session once commit has written the PVD, and
+    // hsf_create_context picks up the newest session by following the volume space sizes.
+    // time_stamp is the session's recording time, the library doesn't read a clock itself;
+    // begin fails if it isn't a valid date. Both commit and abort release the Hsf_Append.
+    int hsf_append_begin(Hsf_Append *append, Hsf_Context *ctx, const Hsf_Time_Stamp *time_stamp);
+    int hsf_append_file(Hsf_Append *append, const char *path, const void *data, u32 size);
+    int hsf_append_commit(Hsf_Append *append);
+    void hsf_append_abort(Hsf_Append *append);
+    
+    // Reads a cooked image front to back from a source that can't seek, like a pipe. read_cb
+    // returns the number of bytes it read, 0 at the end of the stream or -1 on error. Every
+    // file is handed to file_cb in pieces as its extent streams past, in increasing file_offset,
+    // with one call of 0 bytes for empty files. Sectors that aren't claimed by anything known yet
+    // are kept in case a directory later in the stream points back at them. Those and the
+    // directories being read count against memory_budget bytes; held sectors are dropped to make
+    // room, and a directory that doesn't fit at all fails the extraction. Multisession images
+    // (like the ones hsf_append_commit writes) have every session extracted in turn: after the
+    // first session's tree the stream is read up to its volume space size + 16, and if a newer
+    // PVD is there its tree is extracted too. Files it shares with an earlier session aren't
+    // delivered again, files it replaced are delivered again from file_offset 0, so the last
+    // delivery of a path is the newest session's. Stops reading once every extent has been seen
+    // and no newer session follows; returns -1 if the stream ended early, a directory didn't
+    // fit or a file's data had already been dropped.
+    typedef int (*hsf_stream_read_callback)(void *payload, void *buffer, u32 bytes);
+    typedef void (*hsf_stream_file_callback)(const char *path, Hsf_Directory_Entry *entry, const void *data, u32 bytes, u32 file_offset, void *user_payload);
+    int hsf_stream_extract(hsf_stream_read_callback read_cb, void *read_payload, hsf_stream_file_callback file_cb, void *file_payload, u64 memory_budget);
+    
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -226,18 +330,110 @@ extern "C" {
 extern "C" {
 #endif
     
+#ifdef HSF_INCLUDE_PTHREADS
+#include <pthread.h>
+#define HSF_LOCK(mutex)   pthread_mutex_lock(mutex)
+#define HSF_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+#else
+#define HSF_LOCK(mutex)
+#define HSF_UNLOCK(mutex)
+#endif
+    
+    void __hsf_memcpy(void *_dst, const void *_src, u32 size);
+    void __hsf_zero_memory(void *buffer, u64 bytes);
+    int __hsf_strncmp(const char *str0, const char *str1, u32 length);
+    u32 __hsf_strlen(const char *path);
+    
 #ifdef HSF_INCLUDE_STDIO
 #include <stdio.h>
     
-    int __stdio_read_sector(void *payload, void *buffer, u32 sector, u32 sector_count) {
-        int result = fseek((FILE *)payload, sector * HSF_SECTOR_SIZE, SEEK_SET);
-        if (result != 0) return -1;
+    typedef struct
+    {
+        FILE *file;
+        int sector_mode;
+        u32 data_offset; // offset of the user data within a raw sector
+    } Hsf_Stdio_Payload;
+    
+    int __stdio_detect_sector_mode(FILE *file, u32 *data_offset) {
+        static const u8 sync[12] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+        u8 raw[HSF_RAW_SECTOR_SIZE];
+        
+        *data_offset = 0;
+        
+        // look for the PVD where it would sit in a raw image, anything else is treated as cooked
+        if (fseek(file, 0x10 * HSF_RAW_SECTOR_SIZE, SEEK_SET) != 0) return HSF_SECTOR_MODE_COOKED;
+        if (fread(raw, HSF_RAW_SECTOR_SIZE, 1, file) != 1) {
+            clearerr(file);
+            return HSF_SECTOR_MODE_COOKED;
+        }
+        
+        for (u32 i = 0; i < sizeof(sync); ++i) {
+            if (raw[i] != sync[i]) return HSF_SECTOR_MODE_COOKED;
+        }
+        
+        int mode;
+        u32 offset;
+        if (raw[15] == 1) {
+            mode = HSF_SECTOR_MODE_RAW_MODE1;
+            offset = 16;
+        } else if (raw[15] == 2 && !(raw[18] & 0x20)) { // submode bit 5 clear means Form 1
+            mode = HSF_SECTOR_MODE_RAW_MODE2_FORM1;
+            offset = 24;
+        } else {
+            return HSF_SECTOR_MODE_COOKED;
+        }
+        
+        for (u32 i = 0; i < 5; ++i) {
+            if (raw[offset + 1 + i] != (u8)HSF_VD_ID[i]) return HSF_SECTOR_MODE_COOKED;
+        }
+        
+        *data_offset = offset;
+        return mode;
+    }
+    
+    int __stdio_read_raw_sectors(Hsf_Stdio_Payload *stdio, u8 *buffer, u32 sector, u32 sector_count) {
+        // Read as many whole raw sectors as fit in the unfilled tail of the caller's buffer with one
+        // fread, then compact their user data down in place. Each pass fills ~87% of what's left,
+        // so even large reads only take a handful of freads. A last sector that doesn't fit goes
+        // through the scratch buffer.
+        u8 scratch[HSF_RAW_SECTOR_SIZE];
+        
+        while (sector_count) {
+            u32 count = (u32)(((u64)sector_count * HSF_SECTOR_SIZE) / HSF_RAW_SECTOR_SIZE);
+            u8 *raw = buffer;
+            if (count == 0) {
+                count = 1;
+                raw = scratch;
+            }
+            
+            if (fseek(stdio->file, (long)sector * HSF_RAW_SECTOR_SIZE, SEEK_SET) != 0) return -1;
+            if (fread(raw, HSF_RAW_SECTOR_SIZE, count, stdio->file) != count) {
+                clearerr(stdio->file);
+                return -1;
+            }
+            
+            // the destination never runs ahead of the source, so a forward copy is safe here
+            for (u32 i = 0; i < count; ++i) {
+                __hsf_memcpy(buffer + i * HSF_SECTOR_SIZE, raw + i * HSF_RAW_SECTOR_SIZE + stdio->data_offset, HSF_SECTOR_SIZE);
+            }
+            
+            buffer += count * HSF_SECTOR_SIZE;
+            sector += count;
+            sector_count -= count;
+        }
+        
+        return 0;
+    }
+    
+    int __stdio_read_cooked_sectors(Hsf_Stdio_Payload *stdio, void *buffer, u32 sector, u32 sector_count) {
+        FILE *file = stdio->file;
         
-        FILE *file = (FILE *)payload;
+        int result = fseek(file, (long)sector * HSF_SECTOR_SIZE, SEEK_SET);
+        if (result != 0) return -1;
         
         u32 total = 0;
         for (;;) {
-            result = fread(buffer, HSF_SECTOR_SIZE, sector_count-total, file);
+            result = fread((u8 *)buffer + total * HSF_SECTOR_SIZE, HSF_SECTOR_SIZE, sector_count-total, file);
             if (result != (sector_count-total)) {
                 if (ferror(file) || feof(file)) {
                     clearerr(file);
@@ -253,15 +449,42 @@ extern "C" {
         return 0;
     }
     
+    int __stdio_read_sector(void *payload, void *buffer, u32 sector, u32 sector_count) {
+        Hsf_Stdio_Payload *stdio = (Hsf_Stdio_Payload *)payload;
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        // the seek and the read have to stay together when hsf_walk_tree reads from several threads
+        flockfile(stdio->file);
+#endif
+        
+        int result;
+        if (stdio->sector_mode != HSF_SECTOR_MODE_COOKED) {
+            result = __stdio_read_raw_sectors(stdio, (u8 *)buffer, sector, sector_count);
+        } else {
+            result = __stdio_read_cooked_sectors(stdio, buffer, sector, sector_count);
+        }
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        funlockfile(stdio->file);
+#endif
+        
+        return result;
+    }
+    
     int __stdio_write_sector(void *payload, void *buffer, u32 sector, u32 sector_count) {
-        int result = fseek((FILE *)payload, sector * HSF_SECTOR_SIZE, SEEK_SET);
-        if (result != 0) return -1;
+        Hsf_Stdio_Payload *stdio = (Hsf_Stdio_Payload *)payload;
+        
+        // writing raw sectors would mean regenerating the EDC/ECC, which we don't do
+        if (stdio->sector_mode != HSF_SECTOR_MODE_COOKED) return -1;
         
-        FILE *file = (FILE *)payload;
+        FILE *file = stdio->file;
+        
+        int result = fseek(file, (long)sector * HSF_SECTOR_SIZE, SEEK_SET);
+        if (result != 0) return -1;
         
         u32 total = 0;
         for (;;) {
-            result = fwrite(buffer, HSF_SECTOR_SIZE, sector_count-total, file);
+            result = fwrite((u8 *)buffer + total * HSF_SECTOR_SIZE, HSF_SECTOR_SIZE, sector_count-total, file);
             if (result != (sector_count-total)) {
                 if (ferror(file) || feof(file)) {
                     clearerr(file);
@@ -277,7 +500,7 @@ extern "C" {
         return 0;
     }
     
-    void hsf_create_from_fopen(Hsf_Context *ctx, const char *filename) {
+    void hsf_create_from_fopen_with_mode(Hsf_Context *ctx, const char *filename, int io_mode) {
         FILE *file = fopen(filename, "r+b");
         if (!file) {
             // file doesnt exist so open it in create-mode
@@ -287,193 +510,897 @@ extern "C" {
         ctx->pvd = 0;
         if (!file) return;
         
-        hsf_create_context(ctx, file, __stdio_read_sector, __stdio_write_sector, HSF_IO_READ_ONLY);
+        Hsf_Stdio_Payload *stdio = (Hsf_Stdio_Payload *)HSF_ALLOC(sizeof(Hsf_Stdio_Payload));
+        stdio->file = file;
+        stdio->sector_mode = __stdio_detect_sector_mode(file, &stdio->data_offset);
+        
+        hsf_create_context(ctx, stdio, __stdio_read_sector, __stdio_write_sector, io_mode);
+        ctx->sector_mode = stdio->sector_mode;
+    }
+    
+    void hsf_create_from_fopen(Hsf_Context *ctx, const char *filename) {
+        hsf_create_from_fopen_with_mode(ctx, filename, HSF_IO_READ_ONLY);
     }
     
     void hsf_destruct_with_fclose(Hsf_Context *ctx)
     {
-        fclose((FILE *)ctx->user_payload);
+        Hsf_Stdio_Payload *stdio = (Hsf_Stdio_Payload *)ctx->user_payload;
+        fclose(stdio->file);
+        HSF_FREE(stdio);
         hsf_destroy_context(ctx);
     }
 #endif
     
-    int __hsf_is_dchar_set(char C) {
-        if ( (C >= 'A') || (C <= 'Z') ) return 1;
-        if ( (C >= '0') || (C <= '9') ) return 1;
-        if (C == '_') return 1;
+#ifdef HSF_INCLUDE_ODIRECT
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+    
+#ifndef O_DIRECT
+#error "HSF_INCLUDE_ODIRECT needs _GNU_SOURCE defined before any system header is included"
+#endif
+    
+#define HSF_DIRECT_POOL_SLOTS  32
+#define HSF_DIRECT_BOUNCE_SIZE (1024 * 1024)
+#define HSF_DIRECT_POOL_KEEP   (16 * 1024 * 1024) // bigger buffers go back to the OS right away
+    
+    typedef struct
+    {
+        void *memory;
+        u64 bytes;
+        int in_use;
+    } Hsf_Direct_Buffer;
+    
+    typedef struct
+    {
+        int fd;
+        int flags;
+        u32 offset_align; // O_DIRECT wants file offsets and lengths in multiples of this
+        u32 memory_align; // and buffers aligned to this
         
+        Hsf_Direct_Buffer pool[HSF_DIRECT_POOL_SLOTS];
         
-        return 0;
-    }
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_t lock;
+#endif
+    } Hsf_Direct_Payload;
     
-    int __hsf_is_achar_set(char C) {
-        if (__hsf_is_dchar_set(C)) return 1;
-        if (   C == '!' || C == '\"' || C == '%'
-            || C == '&' || C == '\'' || C == '('
-            || C == ')' || C == '*' || C == '+'
-            || C == ',' || C == '-' || C == '.'
-            || C == '/' || C == ':' || C == ';'
-            || C == '<' || C == '=' || C == '>'
-            || C == '?') return 1;
-        
-        return 0;
+    u64 __direct_round_up(u64 value, u64 align) {
+        return ((value + align - 1) / align) * align;
     }
     
-    int __hsf_strncmp(const char *str0, const char *str1, u32 length) {
-        if (!str0 && str1) return -1;
-        if (str0 && !str1) return 1;
-        if (!str0 && !str1) return 0;
+    void *__direct_map(Hsf_Direct_Payload *direct, u64 bytes) {
+        void *memory = MAP_FAILED;
         
-        for (u32 i = 0; i < length; ++i) {
-            int c0 = str0[i];
-            int c1 = str1[i];
-            
-            int result = c0-c1;
-            if (c0 == 0 && c1) return result;
-            if (c1 == 0 && c0) return result;        
-            if (c0 == 0 && c1 == 0) break;
-            
-            if (result == 0) continue;
-            return result;
+#ifdef MAP_HUGETLB
+        if (direct->flags & HSF_DIRECT_HUGE_PAGES) {
+            memory = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
         }
+#endif
         
-        return 0;
+        // no huge pages reserved is the common case, regular pages are still aligned enough
+        if (memory == MAP_FAILED) memory = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return 0;
+        
+        return memory;
     }
     
-    u32 __hsf_strlen(const char *path) {
-        const char *end = path;
-        while (*end) end++;
-        return (u32)(end-path);
+    u64 __direct_buffer_size(Hsf_Direct_Payload *direct, u64 bytes) {
+        // round to a few sizes so buffers are actually reusable
+        u64 granularity = (direct->flags & HSF_DIRECT_HUGE_PAGES) ? (2 * 1024 * 1024) : (64 * 1024);
+        return __direct_round_up(bytes ? bytes : 1, granularity);
     }
     
-    void __hsf_memcpy(void *_dst, const void *_src, u32 size) {
-        u8 *dst = (u8 *)_dst;
-        u8 *src = (u8 *)_src;
+    // returns 0 when every slot is taken, the caller decides what to fall back to
+    void *__direct_acquire(Hsf_Direct_Payload *direct, u64 bytes) {
+        bytes = __direct_buffer_size(direct, bytes);
+        void *out = 0;
         
-        while (size) {
-            *dst = *src;
-            dst++;
-            src++;
-            size--;
+        HSF_LOCK(&direct->lock);
+        
+        Hsf_Direct_Buffer *best = 0;
+        Hsf_Direct_Buffer *empty = 0;
+        for (u32 i = 0; i < HSF_DIRECT_POOL_SLOTS; ++i) {
+            Hsf_Direct_Buffer *slot = &direct->pool[i];
+            if (!slot->memory) {
+                if (!empty) empty = slot;
+            } else if (!slot->in_use && slot->bytes >= bytes && (!best || slot->bytes < best->bytes)) {
+                best = slot;
+            }
         }
-    }
-    
-    void __hsf_memset(void *buffer, u8 value, u64 bytes) {
-        u8 *data = (u8 *)buffer;
-        for (u64  i = 0; i < bytes; ++i) {
-            data[i] = value;
+        
+        if (!best && !empty) {
+            // everything is mapped, trade an idle buffer that's too small for a new one
+            for (u32 i = 0; i < HSF_DIRECT_POOL_SLOTS; ++i) {
+                Hsf_Direct_Buffer *slot = &direct->pool[i];
+                if (!slot->in_use) {
+                    munmap(slot->memory, slot->bytes);
+                    __hsf_zero_memory(slot, sizeof(Hsf_Direct_Buffer));
+                    empty = slot;
+                    break;
+                }
+            }
         }
-    }
-    
-    void __hsf_zero_memory(void *buffer, u64 bytes) {
-        char *data = (char *)buffer;
-        for (u64  i = 0; i < bytes; ++i) {
-            data[i] = 0;
+        
+        if (!best && empty) {
+            empty->memory = __direct_map(direct, bytes);
+            if (empty->memory) {
+                empty->bytes = bytes;
+                best = empty;
+            }
+        }
+        
+        if (best) {
+            best->in_use = 1;
+            out = best->memory;
         }
+        
+        HSF_UNLOCK(&direct->lock);
+        return out;
     }
     
-    void hsf_create_context(Hsf_Context *ctx, void *callback_payload, hsf_read_sector_callback read_cb, hsf_write_sector_callback write_cb, int io_mode) {
-        ctx->user_payload = callback_payload;
-        ctx->read_sector_cb = read_cb;
-        ctx->write_sector_cb = write_cb;
-        ctx->pvd = hsf_get_primary_volume_descriptor(ctx);
-        ctx->io_mode = io_mode;
+    // returns 0 if the buffer didn't come from the pool
+    int __direct_release(Hsf_Direct_Payload *direct, void *memory) {
+        int found = 0;
+        
+        HSF_LOCK(&direct->lock);
+        for (u32 i = 0; i < HSF_DIRECT_POOL_SLOTS; ++i) {
+            Hsf_Direct_Buffer *slot = &direct->pool[i];
+            if (slot->memory != memory) continue;
+            
+            slot->in_use = 0;
+            if (slot->bytes > HSF_DIRECT_POOL_KEEP) {
+                munmap(slot->memory, slot->bytes);
+                __hsf_zero_memory(slot, sizeof(Hsf_Direct_Buffer));
+            }
+            
+            found = 1;
+            break;
+        }
+        HSF_UNLOCK(&direct->lock);
+        
+        return found;
     }
     
-    void hsf_destroy_context(Hsf_Context *ctx) {
-        if (ctx->pvd) HSF_FREE(ctx->pvd);
-        __hsf_zero_memory(ctx, sizeof(Hsf_Context));
+    void *__direct_alloc_buffer(void *payload, u64 bytes) {
+        void *memory = __direct_acquire((Hsf_Direct_Payload *)payload, bytes);
+        
+        // reads into this will just take the bounce path
+        if (!memory) memory = HSF_ALLOC(bytes);
+        return memory;
     }
     
-    int __hsf_read_sectors(Hsf_Context *ctx, u32 sector, u32 sector_count, void *buffer)
-    {
-        return ctx->read_sector_cb(ctx->user_payload, buffer, sector, sector_count);
+    void __direct_free_buffer(void *payload, void *memory) {
+        if (!__direct_release((Hsf_Direct_Payload *)payload, memory)) HSF_FREE(memory);
     }
     
-    int __hsf_write_sectors(Hsf_Context *ctx, u32 sector, u32 sector_count, void *buffer) {
-        if (ctx->io_mode == HSF_IO_READ_WRITE) {
-            return ctx->write_sector_cb(ctx->user_payload, buffer, sector, sector_count); 
+    int __direct_pread(Hsf_Direct_Payload *direct, u8 *buffer, u64 bytes, u64 offset, u64 needed) {
+        u64 total = 0;
+        while (total < bytes) {
+            ssize_t result = pread(direct->fd, buffer + total, bytes - total, (off_t)(offset + total));
+            if (result < 0 && errno == EINTR) continue;
+            
+            // the aligned span can run past the end of the image, which is fine as long as
+            // we got everything that was asked for
+            if (result <= 0) break;
+            total += (u64)result;
         }
         
-        return -1;
+        return (total >= needed) ? 0 : -1;
     }
     
-    /*
-    typedef struct
-    {
-        u8 Type;
-        strA Id[5];
-        u8 Version;
+    int __direct_read_sector(void *payload, void *buffer, u32 sector, u32 sector_count) {
+        Hsf_Direct_Payload *direct = (Hsf_Direct_Payload *)payload;
         
-        u8 Unused0;
-        strA SystemIdentifier[32];
-        strD VolumeIdentifier[32];
-        u8 Unused1[8];
-        u32 VolumeSpaceSizeLE;
-        u32 VolumeSpaceSizeBE;
-        u8 Unused2[32];
-        u16 VolumeSetSizeLE;
-        u16 VolumeSetSizeBE;
-        u16 VolumeSequenceNumberLE;
-        u16 VolumeSequenceNumberBE;
-        u16 LogicalBlockSizeLE;
-        u16 LogicalBlockSizeBE;
-        u32 PathTableSizeLE;
-        u32 PathTableSizeBE;
-        u32 PathTableLocationLE;
-        u32 OptionalPathTableLocationLE;
-        u32 PathTableLocationBE;
-        u32 OptionalPathTableLocationBE;
-        hsf_directory_entry RootDirectoryEntry;
-        char VolumeSetIdentifier[128];
-        char PublisherIdentifier[128];
-        char DataPreparerIdentifier[128];
-        char ApplicationIdentifier[128];
-        char CopyrightFileIdentifier[38];
-        char AbstractFileIdentifier[36];
-        char BibliographicFileIdentifier[37];
-        hsf_date VolumeCreationDate;
-        hsf_date VolumeModificationDate;
-        hsf_date VolumeExpirationDate;
-        hsf_date VolumeEffectiveDate;
-        u8 FileStructureVersion;
-        u8 Unused3;
-        u8 ApplicationUsed[512];
-        u8 Reserved[653];
-    } HSF_PACKED hsf_primary_volume_descriptor;
-    */
-    
-    u32 __hsf_max_u32(u32 a, u32 b) {
-        return (a > b) ? a : b;
-    }
-    
-    int hsf_format_image(Hsf_Context *ctx, const char *primary_volume_name, u64 total_disc_size_sectors) {
-        if (ctx->io_mode == HSF_IO_READ_ONLY) return -1;
+        u64 offset = (u64)sector * HSF_SECTOR_SIZE;
+        u64 bytes = (u64)sector_count * HSF_SECTOR_SIZE;
         
-        if (ctx->pvd) {
-            HSF_FREE(ctx->pvd);
-            ctx->pvd = 0;
+        if ((offset % direct->offset_align) == 0 && (bytes % direct->offset_align) == 0
+            && ((u64)(size_t)buffer % direct->memory_align) == 0) {
+            return __direct_pread(direct, (u8 *)buffer, bytes, offset, bytes);
         }
         
-        // zero all the disc sectors first, this makes it easy to be compatible with standard
-        // fwrite APIs for ensuring the file size without the user worrying about first making sure
-        // the file is the correct size. However, this probably shouldn't be used on a direct file
-        // handle to a CD-R device since it may make the entire disc read-only
-        void *zero_mem = HSF_ALLOC(HSF_SECTOR_SIZE);
-        __hsf_zero_memory(zero_mem, HSF_SECTOR_SIZE);
+        // Misaligned in memory or on disk, go through an aligned bounce buffer a large chunk at a
+        // time. Library-allocated buffers come from the pool, so this only happens for odd
+        // sector spans when the device needs more than 2048-byte alignment.
+        u8 *bounce = (u8 *)__direct_acquire(direct, HSF_DIRECT_BOUNCE_SIZE);
+        u64 bounce_bytes = __direct_buffer_size(direct, HSF_DIRECT_BOUNCE_SIZE);
+        int mapped = 0;
+        if (!bounce) {
+            bounce = (u8 *)__direct_map(direct, HSF_DIRECT_BOUNCE_SIZE);
+            bounce_bytes = HSF_DIRECT_BOUNCE_SIZE;
+            mapped = 1;
+            if (!bounce) return -1;
+        }
         
-        for (u64 i = 0; i < total_disc_size_sectors; ++i) {
-            int result = __hsf_write_sectors(ctx, i, 1, zero_mem);
-            if (result != 0) {
-                HSF_FREE(zero_mem);
-                return -1;
-            }
+        int result = 0;
+        u64 done = 0;
+        while (done < bytes) {
+            u64 want_start = offset + done;
+            u64 aligned_start = (want_start / direct->offset_align) * direct->offset_align;
+            u64 skip = want_start - aligned_start;
+            
+            u64 span = __direct_round_up(skip + (bytes - done), direct->offset_align);
+            if (span > bounce_bytes) span = bounce_bytes;
+            
+            u64 take = span - skip;
+            if (take > bytes - done) take = bytes - done;
+            
+            result = __direct_pread(direct, bounce, span, aligned_start, skip + take);
+            if (result != 0) break;
+            
+            __hsf_memcpy((u8 *)buffer + done, bounce + skip, (u32)take);
+            done += take;
         }
         
-        if (!primary_volume_name) primary_volume_name = HSF_DEFAULT_PRIMARY_VOLUME_NAME;
+        if (mapped) munmap(bounce, HSF_DIRECT_BOUNCE_SIZE);
+        else __direct_release(direct, bounce);
         
-        Hsf_Primary_Volume_Descriptor *pvd = (Hsf_Primary_Volume_Descriptor *)HSF_ALLOC(HSF_SECTOR_SIZE);
-        __hsf_zero_memory(pvd, HSF_SECTOR_SIZE);
+        return result;
+    }
+    
+    void hsf_create_from_open_direct(Hsf_Context *ctx, const char *filename, int flags) {
+        ctx->pvd = 0;
+        
+        int fd = open(filename, O_RDONLY | O_DIRECT);
+        if (fd < 0) return;
+        
+        Hsf_Direct_Payload *direct = (Hsf_Direct_Payload *)HSF_ALLOC(sizeof(Hsf_Direct_Payload));
+        __hsf_zero_memory(direct, sizeof(Hsf_Direct_Payload));
+        direct->fd = fd;
+        direct->flags = flags;
+        
+        // 4096 covers every device we know of when the kernel can't tell us
+        direct->offset_align = 4096;
+        direct->memory_align = 4096;
+        
+#ifdef STATX_DIOALIGN
+        struct statx info;
+        if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &info) == 0 && (info.stx_mask & STATX_DIOALIGN)
+            && info.stx_dio_offset_align && info.stx_dio_mem_align) {
+            direct->offset_align = info.stx_dio_offset_align;
+            direct->memory_align = info.stx_dio_mem_align;
+        }
+#endif
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_init(&direct->lock, 0);
+#endif
+        
+        hsf_create_context(ctx, direct, __direct_read_sector, 0, HSF_IO_READ_ONLY);
+        ctx->alloc_buffer_cb = __direct_alloc_buffer;
+        ctx->free_buffer_cb = __direct_free_buffer;
+    }
+    
+    void hsf_destruct_with_close_direct(Hsf_Context *ctx) {
+        Hsf_Direct_Payload *direct = (Hsf_Direct_Payload *)ctx->user_payload;
+        
+        for (u32 i = 0; i < HSF_DIRECT_POOL_SLOTS; ++i) {
+            if (direct->pool[i].memory) munmap(direct->pool[i].memory, direct->pool[i].bytes);
+        }
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_destroy(&direct->lock);
+#endif
+        
+        close(direct->fd);
+        HSF_FREE(direct);
+        hsf_destroy_context(ctx);
+    }
+#endif
+    
+#ifdef HSF_INCLUDE_DISK_CACHE
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+    
+#define HSF_DISK_CACHE_MAGIC         "HSFCACHE"
+#define HSF_DISK_CACHE_VERSION       3
+#define HSF_DISK_CACHE_CHUNK_SECTORS 32 // 64 KiB, the unit we fetch, track and evict
+#define HSF_DISK_CACHE_HEADER_SIZE   4096
+#define HSF_DISK_CACHE_MAX_RUN       256 // chunks fetched from the backing source in one go
+    
+    // every chunk a u32 sector number can reach, also the most slots a cache can have
+#define HSF_DISK_CACHE_CHUNK_COUNT   (((u64)1 << 32) / HSF_DISK_CACHE_CHUNK_SECTORS)
+#define HSF_DISK_CACHE_NO_CHUNK      0xFFFFFFFF // an empty slot
+#define HSF_DISK_CACHE_NO_SLOT       0xFFFFFFFF // an empty lookup entry
+    
+    // which image the cache was filled from, taken from the newest session's PVD so appending
+    // a session changes it too
+    typedef struct
+    {
+        char volume_identifier[32];
+        u32 volume_space_size;
+        u32 root_location;
+        Hsf_Date creation_date;
+        Hsf_Date modification_date;
+    } Hsf_Disk_Cache_Identity;
+    
+    typedef struct
+    {
+        char magic[8];
+        u32 version;
+        u32 chunk_sectors;
+        u32 clean; // cleared while open, a cache that wasn't closed can't trust its slots
+        u32 slot_count;
+        u32 next_slot; // the oldest slot, the next one to be reused
+        Hsf_Disk_Cache_Identity identity;
+    } Hsf_Disk_Cache_Header;
+    
+    struct Hsf_Disk_Cache
+    {
+        hsf_read_sector_callback read_cb;
+        void *read_payload;
+        
+        int data_fd;
+        int map_fd;
+        u8 *map;
+        u64 map_size;
+        Hsf_Disk_Cache_Header *header;
+        
+        // chunk held by each slot, this lives in the map file right after the header
+        u32 *slots;
+        u32 slot_count;
+        
+        // open-addressed chunk -> slot index, entries are slot numbers keyed by slots[entry]
+        u32 *lookup;
+        u32 lookup_mask;
+        
+        // end of the image, the chunk that reaches past it can't be fetched whole
+        u32 sector_limit;
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_t lock;
+#endif
+    };
+    
+    int __cache_pread(int fd, u8 *buffer, u64 bytes, u64 offset) {
+        u64 total = 0;
+        while (total < bytes) {
+            ssize_t result = pread(fd, buffer + total, bytes - total, (off_t)(offset + total));
+            if (result < 0 && errno == EINTR) continue;
+            if (result <= 0) return -1;
+            total += (u64)result;
+        }
+        
+        return 0;
+    }
+    
+    int __cache_pwrite(int fd, u8 *buffer, u64 bytes, u64 offset) {
+        u64 total = 0;
+        while (total < bytes) {
+            ssize_t result = pwrite(fd, buffer + total, bytes - total, (off_t)(offset + total));
+            if (result < 0 && errno == EINTR) continue;
+            if (result <= 0) return -1;
+            total += (u64)result;
+        }
+        
+        return 0;
+    }
+    
+    u32 __cache_hash(Hsf_Disk_Cache *cache, u32 chunk) {
+        return (chunk * 2654435761u) & cache->lookup_mask;
+    }
+    
+    // returns the slot holding chunk, or HSF_DISK_CACHE_NO_SLOT
+    u32 __cache_find(Hsf_Disk_Cache *cache, u32 chunk) {
+        for (u32 i = __cache_hash(cache, chunk); cache->lookup[i] != HSF_DISK_CACHE_NO_SLOT; i = (i + 1) & cache->lookup_mask) {
+            if (cache->slots[cache->lookup[i]] == chunk) return cache->lookup[i];
+        }
+        
+        return HSF_DISK_CACHE_NO_SLOT;
+    }
+    
+    void __cache_insert(Hsf_Disk_Cache *cache, u32 slot) {
+        u32 i = __cache_hash(cache, cache->slots[slot]);
+        while (cache->lookup[i] != HSF_DISK_CACHE_NO_SLOT) i = (i + 1) & cache->lookup_mask;
+        cache->lookup[i] = slot;
+    }
+    
+    void __cache_remove(Hsf_Disk_Cache *cache, u32 chunk) {
+        u32 hole = __cache_hash(cache, chunk);
+        while (cache->lookup[hole] != HSF_DISK_CACHE_NO_SLOT && cache->slots[cache->lookup[hole]] != chunk) {
+            hole = (hole + 1) & cache->lookup_mask;
+        }
+        if (cache->lookup[hole] == HSF_DISK_CACHE_NO_SLOT) return;
+        
+        // shift later entries back into the hole so every probe run stays unbroken
+        for (u32 i = (hole + 1) & cache->lookup_mask; cache->lookup[i] != HSF_DISK_CACHE_NO_SLOT; i = (i + 1) & cache->lookup_mask) {
+            u32 home = __cache_hash(cache, cache->slots[cache->lookup[i]]);
+            if (((i - home) & cache->lookup_mask) >= ((i - hole) & cache->lookup_mask)) {
+                cache->lookup[hole] = cache->lookup[i];
+                hole = i;
+            }
+        }
+        
+        cache->lookup[hole] = HSF_DISK_CACHE_NO_SLOT;
+    }
+    
+    // empties the oldest slot and hands it out
+    u32 __cache_take_slot(Hsf_Disk_Cache *cache) {
+        u32 slot = cache->header->next_slot;
+        cache->header->next_slot = (slot + 1) % cache->slot_count;
+        
+        if (cache->slots[slot] != HSF_DISK_CACHE_NO_CHUNK) {
+            __cache_remove(cache, cache->slots[slot]);
+            cache->slots[slot] = HSF_DISK_CACHE_NO_CHUNK;
+        }
+        
+        return slot;
+    }
+    
+    // fills buffer with sectors [sector, sector + sector_count) which all sit in the missing
+    // chunks [first_chunk, first_chunk + chunk_count)
+    int __cache_fill(Hsf_Disk_Cache *cache, u8 *buffer, u32 sector, u32 sector_count, u32 first_chunk, u32 chunk_count) {
+        u32 chunk_sector = first_chunk * HSF_DISK_CACHE_CHUNK_SECTORS;
+        
+        // only the chunks that end inside the image get fetched and cached, the rest of the
+        // request is passed straight through
+        u32 limit_chunk = cache->sector_limit / HSF_DISK_CACHE_CHUNK_SECTORS;
+        u32 whole_chunks = chunk_count;
+        if (first_chunk + whole_chunks > limit_chunk) whole_chunks = (limit_chunk > first_chunk) ? limit_chunk - first_chunk : 0;
+        
+        u32 cached_sectors = 0;
+        if (whole_chunks) {
+            u32 fetch_sectors = whole_chunks * HSF_DISK_CACHE_CHUNK_SECTORS;
+            
+            u8 *temp = (u8 *)HSF_ALLOC((u64)fetch_sectors * HSF_SECTOR_SIZE);
+            if (cache->read_cb(cache->read_payload, temp, chunk_sector, fetch_sectors) != 0) {
+                // the image is shorter than its PVD says, just fetch what was asked for
+                HSF_FREE(temp);
+                return cache->read_cb(cache->read_payload, buffer, sector, sector_count);
+            }
+            
+            cached_sectors = chunk_sector + fetch_sectors - sector;
+            if (cached_sectors > sector_count) cached_sectors = sector_count;
+            __hsf_memcpy(buffer, temp + (u64)(sector - chunk_sector) * HSF_SECTOR_SIZE, cached_sectors * HSF_SECTOR_SIZE);
+            
+            u64 chunk_bytes = (u64)HSF_DISK_CACHE_CHUNK_SECTORS * HSF_SECTOR_SIZE;
+            for (u32 i = 0; i < whole_chunks; ++i) {
+                u32 slot = __cache_take_slot(cache);
+                if (__cache_pwrite(cache->data_fd, temp + i * chunk_bytes, chunk_bytes, slot * chunk_bytes) != 0) break;
+                
+                // the slot only names the chunk once the data is in the file
+                cache->slots[slot] = first_chunk + i;
+                __cache_insert(cache, slot);
+            }
+            
+            HSF_FREE(temp);
+        }
+        
+        if (cached_sectors == sector_count) return 0;
+        return cache->read_cb(cache->read_payload, buffer + (u64)cached_sectors * HSF_SECTOR_SIZE, sector + cached_sectors, sector_count - cached_sectors);
+    }
+    
+    int hsf_disk_cache_read_sector(void *payload, void *buffer, u32 sector, u32 sector_count) {
+        Hsf_Disk_Cache *cache = (Hsf_Disk_Cache *)payload;
+        u8 *out = (u8 *)buffer;
+        int result = 0;
+        
+        HSF_LOCK(&cache->lock);
+        
+        u64 position = sector;
+        u64 end = (u64)sector + sector_count;
+        while (position < end && result == 0) {
+            // take the longest run of chunks that are all present or all missing
+            u32 first_chunk = (u32)(position / HSF_DISK_CACHE_CHUNK_SECTORS);
+            int present = __cache_find(cache, first_chunk) != HSF_DISK_CACHE_NO_SLOT;
+            
+            u32 chunk_count = 1;
+            while (chunk_count < HSF_DISK_CACHE_MAX_RUN) {
+                u64 next_sector = (u64)(first_chunk + chunk_count) * HSF_DISK_CACHE_CHUNK_SECTORS;
+                if (next_sector >= end || (__cache_find(cache, first_chunk + chunk_count) != HSF_DISK_CACHE_NO_SLOT) != present) break;
+                chunk_count++;
+            }
+            
+            u64 run_end = (u64)(first_chunk + chunk_count) * HSF_DISK_CACHE_CHUNK_SECTORS;
+            if (run_end > end) run_end = end;
+            u32 run_sectors = (u32)(run_end - position);
+            
+            if (present) {
+                // present chunks sit wherever their slot is, read them one at a time
+                u8 *chunk_out = out;
+                for (u64 at = position; at < run_end && result == 0;) {
+                    u64 chunk = at / HSF_DISK_CACHE_CHUNK_SECTORS;
+                    u64 chunk_end = (chunk + 1) * HSF_DISK_CACHE_CHUNK_SECTORS;
+                    if (chunk_end > run_end) chunk_end = run_end;
+                    
+                    u64 slot_sector = (u64)__cache_find(cache, (u32)chunk) * HSF_DISK_CACHE_CHUNK_SECTORS + at % HSF_DISK_CACHE_CHUNK_SECTORS;
+                    result = __cache_pread(cache->data_fd, chunk_out, (chunk_end - at) * HSF_SECTOR_SIZE, slot_sector * HSF_SECTOR_SIZE);
+                    
+                    chunk_out += (chunk_end - at) * HSF_SECTOR_SIZE;
+                    at = chunk_end;
+                }
+            } else {
+                result = __cache_fill(cache, out, (u32)position, run_sectors, first_chunk, chunk_count);
+            }
+            
+            out += (u64)run_sectors * HSF_SECTOR_SIZE;
+            position = run_end;
+        }
+        
+        HSF_UNLOCK(&cache->lock);
+        return result;
+    }
+    
+    // returns 0 if the source doesn't have a PVD to tell it apart by
+    int __cache_identify(hsf_read_sector_callback read_cb, void *read_payload, Hsf_Disk_Cache_Identity *identity) {
+        __hsf_zero_memory(identity, sizeof(Hsf_Disk_Cache_Identity));
+        
+        // a throwaway context follows the session chain for us
+        Hsf_Context backing;
+        hsf_create_context(&backing, read_payload, read_cb, 0, HSF_IO_READ_ONLY);
+        if (!backing.pvd) return 0;
+        
+        Hsf_Primary_Volume_Descriptor *pvd = backing.pvd;
+        __hsf_memcpy(identity->volume_identifier, pvd->volume_identifier, 32);
+        identity->volume_space_size = pvd->volume_space_size_le;
+        identity->root_location = pvd->root_directory_entry.data_location_le;
+        identity->creation_date = pvd->volume_creation_date;
+        identity->modification_date = pvd->volume_modification_date;
+        
+        hsf_destroy_context(&backing);
+        return 1;
+    }
+    
+    int __cache_same_identity(Hsf_Disk_Cache_Identity *a, Hsf_Disk_Cache_Identity *b) {
+        u8 *bytes_a = (u8 *)a;
+        u8 *bytes_b = (u8 *)b;
+        for (u32 i = 0; i < sizeof(Hsf_Disk_Cache_Identity); ++i) {
+            if (bytes_a[i] != bytes_b[i]) return 0;
+        }
+        
+        return 1;
+    }
+    
+    Hsf_Disk_Cache *hsf_disk_cache_open(const char *path, hsf_read_sector_callback read_cb, void *read_payload, u64 max_bytes) {
+        u32 path_length = __hsf_strlen(path);
+        char *map_path = (char *)HSF_ALLOC(path_length + 5);
+        __hsf_memcpy(map_path, path, path_length);
+        __hsf_memcpy(map_path + path_length, ".map", 5);
+        
+        int data_fd = open(path, O_RDWR | O_CREAT, 0644);
+        int map_fd = open(map_path, O_RDWR | O_CREAT, 0644);
+        HSF_FREE(map_path);
+        
+        if (data_fd < 0 || map_fd < 0) {
+            if (data_fd >= 0) close(data_fd);
+            if (map_fd >= 0) close(map_fd);
+            return 0;
+        }
+        
+        // without a PVD we can't tell whether the cache is for this image, so it starts empty
+        Hsf_Disk_Cache_Identity identity;
+        int identified = __cache_identify(read_cb, read_payload, &identity);
+        
+        u64 chunk_bytes = (u64)HSF_DISK_CACHE_CHUNK_SECTORS * HSF_SECTOR_SIZE;
+        u64 slot_count = max_bytes / chunk_bytes;
+        if (slot_count == 0) slot_count = 1;
+        if (slot_count > HSF_DISK_CACHE_CHUNK_COUNT) slot_count = HSF_DISK_CACHE_CHUNK_COUNT;
+        
+        Hsf_Disk_Cache_Header header;
+        __hsf_zero_memory(&header, sizeof(Hsf_Disk_Cache_Header));
+        int valid = __cache_pread(map_fd, (u8 *)&header, sizeof(Hsf_Disk_Cache_Header), 0) == 0
+            && __hsf_strncmp(header.magic, HSF_DISK_CACHE_MAGIC, 8) == 0
+            && header.version == HSF_DISK_CACHE_VERSION
+            && header.chunk_sectors == HSF_DISK_CACHE_CHUNK_SECTORS
+            && header.clean
+            && header.slot_count == slot_count
+            && identified
+            && __cache_same_identity(&header.identity, &identity);
+        
+        if (!valid) {
+            // start over, truncating both drops any stale data
+            int result = ftruncate(data_fd, 0);
+            result |= ftruncate(map_fd, 0);
+            if (result != 0) {
+                close(data_fd);
+                close(map_fd);
+                return 0;
+            }
+        }
+        
+        u64 map_size = HSF_DISK_CACHE_HEADER_SIZE + slot_count * sizeof(u32);
+        void *map = MAP_FAILED;
+        if (ftruncate(map_fd, (off_t)map_size) == 0) {
+            map = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+        }
+        
+        if (map == MAP_FAILED) {
+            close(data_fd);
+            close(map_fd);
+            return 0;
+        }
+        
+        Hsf_Disk_Cache *cache = (Hsf_Disk_Cache *)HSF_ALLOC(sizeof(Hsf_Disk_Cache));
+        __hsf_zero_memory(cache, sizeof(Hsf_Disk_Cache));
+        cache->read_cb = read_cb;
+        cache->read_payload = read_payload;
+        cache->data_fd = data_fd;
+        cache->map_fd = map_fd;
+        cache->map = (u8 *)map;
+        cache->map_size = map_size;
+        cache->header = (Hsf_Disk_Cache_Header *)map;
+        cache->slots = (u32 *)(cache->map + HSF_DISK_CACHE_HEADER_SIZE);
+        cache->slot_count = (u32)slot_count;
+        cache->sector_limit = identified ? identity.volume_space_size : 0xFFFFFFFF;
+        
+        Hsf_Disk_Cache_Header *mapped_header = cache->header;
+        __hsf_memcpy(mapped_header->magic, HSF_DISK_CACHE_MAGIC, 8);
+        mapped_header->version = HSF_DISK_CACHE_VERSION;
+        mapped_header->chunk_sectors = HSF_DISK_CACHE_CHUNK_SECTORS;
+        mapped_header->clean = 0;
+        mapped_header->slot_count = (u32)slot_count;
+        mapped_header->identity = identity;
+        if (!valid || mapped_header->next_slot >= slot_count) mapped_header->next_slot = 0;
+        if (!valid) {
+            for (u32 i = 0; i < cache->slot_count; ++i) cache->slots[i] = HSF_DISK_CACHE_NO_CHUNK;
+        }
+        msync(map, HSF_DISK_CACHE_HEADER_SIZE, MS_SYNC);
+        
+        // at most half full so probe runs stay short
+        u32 lookup_size = 2;
+        while (lookup_size < slot_count * 2) lookup_size *= 2;
+        cache->lookup_mask = lookup_size - 1;
+        cache->lookup = (u32 *)HSF_ALLOC(sizeof(u32) * lookup_size);
+        for (u32 i = 0; i < lookup_size; ++i) cache->lookup[i] = HSF_DISK_CACHE_NO_SLOT;
+        
+        for (u32 slot = 0; slot < cache->slot_count; ++slot) {
+            u32 chunk = cache->slots[slot];
+            if (chunk == HSF_DISK_CACHE_NO_CHUNK) continue;
+            
+            // a chunk can only be in one slot, anything else is garbage
+            if (chunk >= HSF_DISK_CACHE_CHUNK_COUNT || __cache_find(cache, chunk) != HSF_DISK_CACHE_NO_SLOT) {
+                cache->slots[slot] = HSF_DISK_CACHE_NO_CHUNK;
+                continue;
+            }
+            
+            __cache_insert(cache, slot);
+        }
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_init(&cache->lock, 0);
+#endif
+        
+        return cache;
+    }
+    
+    void hsf_disk_cache_close(Hsf_Disk_Cache *cache) {
+        // everything the slots claim has to be on disk before we call it clean
+        fdatasync(cache->data_fd);
+        msync(cache->map, cache->map_size, MS_SYNC);
+        
+        cache->header->clean = 1;
+        msync(cache->map, HSF_DISK_CACHE_HEADER_SIZE, MS_SYNC);
+        
+        munmap(cache->map, cache->map_size);
+        close(cache->map_fd);
+        close(cache->data_fd);
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_destroy(&cache->lock);
+#endif
+        
+        HSF_FREE(cache->lookup);
+        HSF_FREE(cache);
+    }
+#endif
+    
+    int __hsf_is_dchar_set(char C) {
+        if ( (C >= 'A') || (C <= 'Z') ) return 1;
+        if ( (C >= '0') || (C <= '9') ) return 1;
+        if (C == '_') return 1;
+        
+        
+        return 0;
+    }
+    
+    int __hsf_is_achar_set(char C) {
+        if (__hsf_is_dchar_set(C)) return 1;
+        if (   C == '!' || C == '\"' || C == '%'
+            || C == '&' || C == '\'' || C == '('
+            || C == ')' || C == '*' || C == '+'
+            || C == ',' || C == '-' || C == '.'
+            || C == '/' || C == ':' || C == ';'
+            || C == '<' || C == '=' || C == '>'
+            || C == '?') return 1;
+        
+        return 0;
+    }
+    
+    int __hsf_strncmp(const char *str0, const char *str1, u32 length) {
+        if (!str0 && str1) return -1;
+        if (str0 && !str1) return 1;
+        if (!str0 && !str1) return 0;
+        
+        for (u32 i = 0; i < length; ++i) {
+            int c0 = str0[i];
+            int c1 = str1[i];
+            
+            int result = c0-c1;
+            if (c0 == 0 && c1) return result;
+            if (c1 == 0 && c0) return result;        
+            if (c0 == 0 && c1 == 0) break;
+            
+            if (result == 0) continue;
+            return result;
+        }
+        
+        return 0;
+    }
+    
+    u32 __hsf_strlen(const char *path) {
+        const char *end = path;
+        while (*end) end++;
+        return (u32)(end-path);
+    }
+    
+    void __hsf_memcpy(void *_dst, const void *_src, u32 size) {
+        u8 *dst = (u8 *)_dst;
+        u8 *src = (u8 *)_src;
+        
+        while (size) {
+            *dst = *src;
+            dst++;
+            src++;
+            size--;
+        }
+    }
+    
+    void __hsf_memset(void *buffer, u8 value, u64 bytes) {
+        u8 *data = (u8 *)buffer;
+        for (u64  i = 0; i < bytes; ++i) {
+            data[i] = value;
+        }
+    }
+    
+    void __hsf_zero_memory(void *buffer, u64 bytes) {
+        char *data = (char *)buffer;
+        for (u64  i = 0; i < bytes; ++i) {
+            data[i] = 0;
+        }
+    }
+    
+    void hsf_create_context(Hsf_Context *ctx, void *callback_payload, hsf_read_sector_callback read_cb, hsf_write_sector_callback write_cb, int io_mode) {
+        ctx->user_payload = callback_payload;
+        ctx->read_sector_cb = read_cb;
+        ctx->write_sector_cb = write_cb;
+        ctx->alloc_buffer_cb = 0;
+        ctx->free_buffer_cb = 0;
+        ctx->io_mode = io_mode;
+        ctx->sector_mode = HSF_SECTOR_MODE_COOKED;
+        ctx->pvd = hsf_get_primary_volume_descriptor(ctx);
+        
+        // sessions added by hsf_append_commit start where the previous volume space ends
+        while (ctx->pvd) {
+            Hsf_Primary_Volume_Descriptor *next = (Hsf_Primary_Volume_Descriptor *)hsf_get_sector(ctx, ctx->pvd->volume_space_size_le + 0x10);
+            if (!next) break;
+            
+            if (next->type != HSF_VD_TYPE_PVD || __hsf_strncmp(&next->id[0], HSF_VD_ID, 5) != 0
+                || next->volume_space_size_le <= ctx->pvd->volume_space_size_le) {
+                HSF_FREE(next);
+                break;
+            }
+            
+            HSF_FREE(ctx->pvd);
+            ctx->pvd = next;
+        }
+        
+        // every offset in here is in 2048-byte logical blocks, anything else isn't supported
+        if (ctx->pvd && ctx->pvd->logical_block_size_le != HSF_SECTOR_SIZE) {
+            HSF_FREE(ctx->pvd);
+            ctx->pvd = 0;
+        }
+    }
+    
+    void hsf_destroy_context(Hsf_Context *ctx) {
+        if (ctx->pvd) HSF_FREE(ctx->pvd);
+        __hsf_zero_memory(ctx, sizeof(Hsf_Context));
+    }
+    
+    void *__hsf_alloc_buffer(Hsf_Context *ctx, u64 bytes) {
+        if (ctx->alloc_buffer_cb) return ctx->alloc_buffer_cb(ctx->user_payload, bytes);
+        return HSF_ALLOC(bytes);
+    }
+    
+    void __hsf_free_buffer(Hsf_Context *ctx, void *buffer) {
+        if (ctx->free_buffer_cb) ctx->free_buffer_cb(ctx->user_payload, buffer);
+        else HSF_FREE(buffer);
+    }
+    
+    int __hsf_read_sectors(Hsf_Context *ctx, u32 sector, u32 sector_count, void *buffer)
+    {
+        return ctx->read_sector_cb(ctx->user_payload, buffer, sector, sector_count);
+    }
+    
+    int __hsf_write_sectors(Hsf_Context *ctx, u32 sector, u32 sector_count, void *buffer) {
+        if (ctx->io_mode == HSF_IO_READ_WRITE) {
+            return ctx->write_sector_cb(ctx->user_payload, buffer, sector, sector_count); 
+        }
+        
+        return -1;
+    }
+    
+    /*
+    typedef struct
+    {
+        u8 Type;
+        strA Id[5];
+        u8 Version;
+        
+        u8 Unused0;
+        strA SystemIdentifier[32];
+        strD VolumeIdentifier[32];
+        u8 Unused1[8];
+        u32 VolumeSpaceSizeLE;
+        u32 VolumeSpaceSizeBE;
+        u8 Unused2[32];
+        u16 VolumeSetSizeLE;
+        u16 VolumeSetSizeBE;
+        u16 VolumeSequenceNumberLE;
+        u16 VolumeSequenceNumberBE;
+        u16 LogicalBlockSizeLE;
+        u16 LogicalBlockSizeBE;
+        u32 PathTableSizeLE;
+        u32 PathTableSizeBE;
+        u32 PathTableLocationLE;
+        u32 OptionalPathTableLocationLE;
+        u32 PathTableLocationBE;
+        u32 OptionalPathTableLocationBE;
+        hsf_directory_entry RootDirectoryEntry;
+        char VolumeSetIdentifier[128];
+        char PublisherIdentifier[128];
+        char DataPreparerIdentifier[128];
+        char ApplicationIdentifier[128];
+        char CopyrightFileIdentifier[38];
+        char AbstractFileIdentifier[36];
+        char BibliographicFileIdentifier[37];
+        hsf_date VolumeCreationDate;
+        hsf_date VolumeModificationDate;
+        hsf_date VolumeExpirationDate;
+        hsf_date VolumeEffectiveDate;
+        u8 FileStructureVersion;
+        u8 Unused3;
+        u8 ApplicationUsed[512];
+        u8 Reserved[653];
+    } HSF_PACKED hsf_primary_volume_descriptor;
+    */
+    
+    u32 __hsf_max_u32(u32 a, u32 b) {
+        return (a > b) ? a : b;
+    }
+    
+    int hsf_format_image(Hsf_Context *ctx, const char *primary_volume_name, u64 total_disc_size_sectors) {
+        if (ctx->io_mode == HSF_IO_READ_ONLY) return -1;
+        
+        if (ctx->pvd) {
+            HSF_FREE(ctx->pvd);
+            ctx->pvd = 0;
+        }
+        
+        // zero all the disc sectors first, this makes it easy to be compatible with standard
+        // fwrite APIs for ensuring the file size without the user worrying about first making sure
+        // the file is the correct size. However, this probably shouldn't be used on a direct file
+        // handle to a CD-R device since it may make the entire disc read-only
+        void *zero_mem = HSF_ALLOC(HSF_SECTOR_SIZE);
+        __hsf_zero_memory(zero_mem, HSF_SECTOR_SIZE);
+        
+        for (u64 i = 0; i < total_disc_size_sectors; ++i) {
+            int result = __hsf_write_sectors(ctx, i, 1, zero_mem);
+            if (result != 0) {
+                HSF_FREE(zero_mem);
+                return -1;
+            }
+        }
+        
+        if (!primary_volume_name) primary_volume_name = HSF_DEFAULT_PRIMARY_VOLUME_NAME;
+        
+        Hsf_Primary_Volume_Descriptor *pvd = (Hsf_Primary_Volume_Descriptor *)HSF_ALLOC(HSF_SECTOR_SIZE);
+        __hsf_zero_memory(pvd, HSF_SECTOR_SIZE);
         
         pvd->type = HSF_VD_TYPE_PVD;
         __hsf_memcpy(&pvd->id[0], HSF_VD_ID, 5);
@@ -481,229 +1408,1775 @@ extern "C" {
         __hsf_memcpy(&pvd->system_identifier[0], "", 0); // @TODO see what grub expects here
         __hsf_memcpy(&pvd->volume_identifier[0], primary_volume_name, __hsf_max_u32(__hsf_strlen(primary_volume_name), 32));
         
-        HSF_FREE(zero_mem);
+        HSF_FREE(zero_mem);
+        return 0;
+    }
+    
+    // for a first or last sector the read only covers part of
+    int __hsf_read_partial_sector(Hsf_Context *ctx, u32 sector, u32 start, void *buffer, u32 bytes) {
+        void *temp = __hsf_alloc_buffer(ctx, HSF_SECTOR_SIZE);
+        int result = __hsf_read_sectors(ctx, sector, 1, temp);
+        if (result == 0) __hsf_memcpy(buffer, ((u8 *)temp) + start, bytes);
+        
+        __hsf_free_buffer(ctx, temp);
+        return result;
+    }
+    
+    int hsf_file_read(void *buffer, u64 count_bytes, Hsf_File *file) {
+        Hsf_Context *ctx = file->ctx;
+        
+        u32 sector = file->directory_entry->data_location_le + (file->seek_position / HSF_SECTOR_SIZE);
+        u32 start = file->seek_position % HSF_SECTOR_SIZE;
+        u8 *out = (u8 *)buffer;
+        u64 remaining = count_bytes;
+        
+        if (remaining && (start || remaining < HSF_SECTOR_SIZE)) {
+            u32 bytes = HSF_SECTOR_SIZE - start;
+            if (bytes > remaining) bytes = (u32)remaining;
+            
+            if (__hsf_read_partial_sector(ctx, sector, start, out, bytes) != 0) return -1;
+            
+            out += bytes;
+            remaining -= bytes;
+            sector++;
+        }
+        
+        // whole sectors go straight into the caller's buffer, no bounce and no copy
+        u32 whole_sectors = (u32)(remaining / HSF_SECTOR_SIZE);
+        if (whole_sectors) {
+            if (__hsf_read_sectors(ctx, sector, whole_sectors, out) != 0) return -1;
+            
+            out += (u64)whole_sectors * HSF_SECTOR_SIZE;
+            remaining -= (u64)whole_sectors * HSF_SECTOR_SIZE;
+            sector += whole_sectors;
+        }
+        
+        if (remaining) {
+            if (__hsf_read_partial_sector(ctx, sector, 0, out, (u32)remaining) != 0) return -1;
+        }
+        
+        file->seek_position += count_bytes;
+        return 0;
+    }
+    
+    void *hsf_get_sector(Hsf_Context *ctx, u32 sector) {
+        void *buffer = HSF_ALLOC(HSF_SECTOR_SIZE);
+        int result = __hsf_read_sectors(ctx, sector, 1, buffer);
+        if (result != 0) {
+            HSF_FREE(buffer);
+            return 0;
+        }
+        return buffer;
+    }
+    
+    Hsf_Primary_Volume_Descriptor *hsf_get_primary_volume_descriptor(Hsf_Context *ctx) {
+        void *buffer = hsf_get_sector(ctx, 0x10);
+        return (Hsf_Primary_Volume_Descriptor *)buffer;
+    }
+    
+    int __hsf_parse_next_path_identifier(const char *path, int start_offset) {
+        u32 path_len = __hsf_strlen(path);
+        if (start_offset >= path_len) return path_len;
+        
+        const char *start = path + start_offset;
+        u32 length = __hsf_strlen(start);
+        
+        for (u32 i = 0; i < length; ++i) {
+            char c = start[i];
+            
+            if (c == HSF_PATH_SEPARATOR) {
+                return start_offset + i;
+            } else if (__hsf_is_dchar_set(c)) {
+                continue;
+            } else {
+                return -1;
+            }
+        }
+        
+        return start_offset + length;
+    }
+    
+    int __hsf_is_valid_path(const char *filename) {
+        if (!filename) return -1;
+        
+        while (*filename) {
+            char c = *filename;
+            if (!(c == HSF_PATH_SEPARATOR || __hsf_is_dchar_set(c)) ) return -1;
+            filename++;
+        }
+        
+        return 0;
+    }
+    
+    u32 __hsf_get_filename_length(Hsf_Directory_Entry *entry) {
+        u32 max = entry->filename_length;
+        
+        for (u32 i = 0; i <= max; ++i) {
+            char c = entry->filename[i];
+            
+            if (c == '.' && i < max) {
+                char d = entry->filename[i+1];
+                if (d == ';') return i;
+            }
+            
+            // @FixMe -1 hwew is potentially very bad if i == 0, but maybe that never happens, i dunno man.
+            if (c == ';') return i;
+        }
+        
+        return max;
+    }
+    
+    Hsf_Directory_Entry *hsf_get_directory_entry(Hsf_Context *ctx, const char *filename) {
+        if (__hsf_is_valid_path(filename) == -1) return 0;
+        
+        int offset = __hsf_parse_next_path_identifier(filename, 0);
+        if (offset == -1) return 0;
+        
+        int name_end = __hsf_parse_next_path_identifier(filename, offset + 2);
+        
+        void *buffer = hsf_get_sector(ctx, ctx->pvd->root_directory_entry.data_location_le);
+        if (!buffer) return 0;
+        
+        Hsf_Directory_Entry *re = (Hsf_Directory_Entry *)buffer;
+        
+        if (name_end == 1) {
+            return re;
+        }
+        
+        offset = 1;
+        
+        int index_current = 0;
+        // @TODO handle the case that you need > 2048 bytes
+        int index_max = re->data_length_le;
+        
+        while (index_current < index_max) {
+            if (re->length == 0) break;
+            if (name_end == offset) break;
+            
+            u32 length = name_end - offset;
+            u32 filename_len = __hsf_get_filename_length(re); 
+            
+            if (length == filename_len) {
+                if (__hsf_strncmp(&re->filename[0], filename + offset, length) == 0) {
+                    if (re->file_flags & HSF_FILE_FLAG_IS_DIR) {
+                        offset = name_end + 1;
+                        name_end = __hsf_parse_next_path_identifier(filename, offset);
+                        
+                        void *new_sector = hsf_get_sector(ctx, re->data_location_le);
+                        HSF_FREE(buffer);
+                        if (!new_sector) return 0;
+                        
+                        buffer = new_sector;
+                        re = (Hsf_Directory_Entry *)buffer;
+                        index_current = 0;
+                        index_max = re->data_length_le;
+                        
+                        if (name_end <= offset) {
+                            return re;
+                        }
+                        
+                        continue;
+                    } else {
+                        offset = name_end + 1;
+                        name_end = __hsf_parse_next_path_identifier(filename, offset);
+                        
+                        if (name_end <= offset) {
+                            Hsf_Directory_Entry *out = (Hsf_Directory_Entry *)HSF_ALLOC(re->length);
+                            __hsf_memcpy(out, re, re->length);
+                            HSF_FREE(buffer);
+                            return (Hsf_Directory_Entry *)out;
+                        } else {
+                            break; // there's more in the path so the path may be invalid after this point
+                        }
+                    }
+                }
+            }
+            
+            index_current += re->length;
+            re = (Hsf_Directory_Entry *)((u8 *)re + re->length);
+        }
+        
+        HSF_FREE(buffer);
+        return 0;
+    }
+    
+    Hsf_File *hsf_file_open(Hsf_Context *ctx, const char *filename) {
+        Hsf_File *file = (Hsf_File *)HSF_ALLOC(sizeof(Hsf_File));
+        file->ctx = ctx;
+        file->directory_entry = hsf_get_directory_entry(ctx, filename);
+        file->seek_position = 0;
+        
+        // File not found
+        if (!file->directory_entry)  {
+            HSF_FREE(file);
+            return 0;
+        }
+        
+        return file;
+    }
+    
+    void hsf_file_close(Hsf_File *file) {
+        HSF_FREE(file->directory_entry);
+        HSF_FREE(file);
+    }
+    
+    void hsf_file_seek(Hsf_File *file, u32 offset, int seek_type) {
+        // @FixMe this is unsafe because we dont range-check Offset
+        if (seek_type == HSF_SEEK_SET) {
+            file->seek_position = offset;
+        } else if (seek_type == HSF_SEEK_CUR) {
+            file->seek_position += offset;
+        } else if (seek_type == HSF_SEEK_END) {
+            file->seek_position = file->directory_entry->data_length_le - offset;
+        }
+    }
+    
+    u32 hsf_file_tell(Hsf_File *file) {
+        return file->seek_position;
+    }
+    
+    void hsf_visit_directory(Hsf_Context *ctx, const char *dir_path, hsf_visitor_callback visitor_callback, void *user_payload) {
+        Hsf_Directory_Entry *entry = hsf_get_directory_entry(ctx, dir_path);
+        
+        if (entry) {
+            Hsf_Directory_Entry *entry_memory = entry;
+            int index_current = 0;
+            int index_max = entry->data_length_le;
+            
+            while (index_current < index_max) {
+                if (entry->length == 0) break;
+                
+                visitor_callback(ctx, dir_path, entry, user_payload);
+                
+                index_current+= entry->length;
+                entry = (Hsf_Directory_Entry *)((u8 *)entry + entry->length);
+            }
+            
+            HSF_FREE(entry_memory);
+        } else {
+            // @TODO error
+        }
+    }
+    
+    void *__hsf_read_extent(Hsf_Context *ctx, u32 location, u32 length) {
+        u32 sector_count = (length / HSF_SECTOR_SIZE) + ((length % HSF_SECTOR_SIZE) ? 1 : 0);
+        if (sector_count == 0) return 0;
+        
+        void *buffer = __hsf_alloc_buffer(ctx, (u64)sector_count * HSF_SECTOR_SIZE);
+        int result = __hsf_read_sectors(ctx, location, sector_count, buffer);
+        if (result != 0) {
+            __hsf_free_buffer(ctx, buffer);
+            return 0;
+        }
+        
+        return buffer;
+    }
+    
+    int __hsf_is_dot_entry(Hsf_Directory_Entry *entry) {
+        // '.' and '..' are stored as the single bytes 0x00 and 0x01
+        return entry->filename_length == 1 && (entry->filename[0] == 0 || entry->filename[0] == 1);
+    }
+    
+    // open-addressed set of u64 keys, each one is stored + 1 so 0 marks a free slot
+    typedef struct
+    {
+        u64 *slots;
+        u32 count;
+        u32 capacity;
+    } Hsf_Key_Set;
+    
+    u32 __hsf_key_set_hash(u64 key, u32 capacity) {
+        return (u32)((key ^ (key >> 32)) * 2654435761u) & (capacity - 1);
+    }
+    
+    int __hsf_key_set_contains(Hsf_Key_Set *set, u64 key) {
+        if (!set->capacity) return 0;
+        
+        for (u32 slot = __hsf_key_set_hash(key + 1, set->capacity); set->slots[slot]; slot = (slot + 1) & (set->capacity - 1)) {
+            if (set->slots[slot] == key + 1) return 1;
+        }
+        
+        return 0;
+    }
+    
+    // returns 0 if key was already in the set
+    int __hsf_key_set_insert(Hsf_Key_Set *set, u64 key) {
+        if (__hsf_key_set_contains(set, key)) return 0;
+        
+        if ((set->count + 1) * 2 > set->capacity) {
+            u32 capacity = set->capacity ? set->capacity * 2 : 64;
+            u64 *slots = (u64 *)HSF_ALLOC(sizeof(u64) * capacity);
+            __hsf_zero_memory(slots, sizeof(u64) * capacity);
+            
+            for (u32 i = 0; i < set->capacity; ++i) {
+                if (!set->slots[i]) continue;
+                
+                u32 slot = __hsf_key_set_hash(set->slots[i], capacity);
+                while (slots[slot]) slot = (slot + 1) & (capacity - 1);
+                slots[slot] = set->slots[i];
+            }
+            
+            if (set->slots) HSF_FREE(set->slots);
+            set->slots = slots;
+            set->capacity = capacity;
+        }
+        
+        u32 slot = __hsf_key_set_hash(key + 1, set->capacity);
+        while (set->slots[slot]) slot = (slot + 1) & (set->capacity - 1);
+        set->slots[slot] = key + 1;
+        set->count++;
+        return 1;
+    }
+    
+    void __hsf_key_set_free(Hsf_Key_Set *set) {
+        if (set->slots) HSF_FREE(set->slots);
+        __hsf_zero_memory(set, sizeof(Hsf_Key_Set));
+    }
+    
+    // anything nested deeper than this is taken to be a directory that loops back on itself
+#define HSF_WALK_MAX_DEPTH 255
+    
+    typedef struct
+    {
+        u32 location;
+        u32 length;
+        u32 depth;
+        char *path;
+    } Hsf_Walk_Item;
+    
+    // Each worker owns one of these. Normally the owner takes from the back and thieves take from
+    // the front. With HSF_WALK_ORDER_LBA it's a min-heap on location instead: the owner pops the
+    // lowest LBA and thieves take the last leaf, which keeps the heap intact.
+    typedef struct
+    {
+        Hsf_Walk_Item *items;
+        u32 head;
+        u32 count;
+        u32 capacity;
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_t lock;
+#endif
+    } Hsf_Walk_Queue;
+    
+    typedef struct
+    {
+        Hsf_Context *ctx;
+        hsf_visitor_callback visitor_cb;
+        void **thread_payloads;
+        Hsf_Walk_Queue *queues;
+        u32 queue_count;
+        int flags;
+        
+        // directories queued or being read, the walk is done once this drops to 0
+        u32 pending;
+        // bumped on every push so an idle worker can tell it missed new work before sleeping
+        u32 generation;
+        int error;
+        
+        // directory locations already queued, a directory reached twice means the tree loops
+        Hsf_Key_Set visited;
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+#endif
+    } Hsf_Walk;
+    
+    typedef struct
+    {
+        Hsf_Walk *walk;
+        u32 index;
+    } Hsf_Walk_Worker;
+    
+    void __hsf_walk_swap(Hsf_Walk_Item *a, Hsf_Walk_Item *b) {
+        Hsf_Walk_Item temp = *a;
+        *a = *b;
+        *b = temp;
+    }
+    
+    void __hsf_walk_push(Hsf_Walk_Queue *queue, Hsf_Walk_Item item, int flags) {
+        if (queue->head == queue->count) {
+            queue->head = 0;
+            queue->count = 0;
+        }
+        
+        if (queue->count == queue->capacity) {
+            u32 capacity = queue->capacity ? queue->capacity * 2 : 64;
+            Hsf_Walk_Item *items = (Hsf_Walk_Item *)HSF_ALLOC(sizeof(Hsf_Walk_Item) * capacity);
+            
+            // slide everything down to the front while we're copying anyway
+            u32 live = queue->count - queue->head;
+            __hsf_memcpy(items, queue->items + queue->head, live * sizeof(Hsf_Walk_Item));
+            if (queue->items) HSF_FREE(queue->items);
+            
+            queue->items = items;
+            queue->head = 0;
+            queue->count = live;
+            queue->capacity = capacity;
+        }
+        
+        u32 index = queue->count++;
+        queue->items[index] = item;
+        
+        if (flags & HSF_WALK_ORDER_LBA) {
+            while (index) {
+                u32 parent = (index - 1) / 2;
+                if (queue->items[parent].location <= queue->items[index].location) break;
+                
+                __hsf_walk_swap(&queue->items[parent], &queue->items[index]);
+                index = parent;
+            }
+        }
+    }
+    
+    int __hsf_walk_pop(Hsf_Walk_Queue *queue, Hsf_Walk_Item *out, int flags) {
+        if (queue->head == queue->count) return 0;
+        
+        if (!(flags & HSF_WALK_ORDER_LBA)) {
+            *out = queue->items[--queue->count];
+            return 1;
+        }
+        
+        *out = queue->items[0];
+        queue->items[0] = queue->items[--queue->count];
+        
+        u32 index = 0;
+        for (;;) {
+            u32 smallest = index;
+            u32 left = index * 2 + 1;
+            u32 right = left + 1;
+            
+            if (left < queue->count && queue->items[left].location < queue->items[smallest].location) smallest = left;
+            if (right < queue->count && queue->items[right].location < queue->items[smallest].location) smallest = right;
+            if (smallest == index) break;
+            
+            __hsf_walk_swap(&queue->items[smallest], &queue->items[index]);
+            index = smallest;
+        }
+        
+        return 1;
+    }
+    
+    int __hsf_walk_steal(Hsf_Walk_Queue *queue, Hsf_Walk_Item *out, int flags) {
+        if (queue->head == queue->count) return 0;
+        
+        if (flags & HSF_WALK_ORDER_LBA) {
+            *out = queue->items[--queue->count];
+        } else {
+            *out = queue->items[queue->head++];
+        }
+        
+        return 1;
+    }
+    
+    char *__hsf_walk_join_path(const char *dir_path, Hsf_Directory_Entry *entry) {
+        u32 dir_length = __hsf_strlen(dir_path);
+        if (dir_length == 1 && dir_path[0] == HSF_PATH_SEPARATOR) dir_length = 0;
+        
+        char *path = (char *)HSF_ALLOC(dir_length + 1 + entry->filename_length + 1);
+        __hsf_memcpy(path, dir_path, dir_length);
+        path[dir_length] = HSF_PATH_SEPARATOR;
+        __hsf_memcpy(path + dir_length + 1, &entry->filename[0], entry->filename_length);
+        path[dir_length + 1 + entry->filename_length] = 0;
+        
+        return path;
+    }
+    
+    void __hsf_walk_directory(Hsf_Walk *walk, u32 worker_index, Hsf_Walk_Item *item) {
+        Hsf_Context *ctx = walk->ctx;
+        Hsf_Walk_Queue *queue = &walk->queues[worker_index];
+        void *payload = walk->thread_payloads ? walk->thread_payloads[worker_index] : 0;
+        
+        if (item->length == 0) return;
+        
+        u8 *buffer = (u8 *)__hsf_read_extent(ctx, item->location, item->length);
+        if (!buffer) {
+            HSF_LOCK(&walk->lock);
+            walk->error = 1;
+            HSF_UNLOCK(&walk->lock);
+            return;
+        }
+        
+        u32 offset = 0;
+        while (offset < item->length) {
+            Hsf_Directory_Entry *entry = (Hsf_Directory_Entry *)(buffer + offset);
+            
+            if (entry->length == 0) {
+                // records never straddle a sector, the rest of this one is padding
+                offset = (offset / HSF_SECTOR_SIZE + 1) * HSF_SECTOR_SIZE;
+                continue;
+            }
+            
+            if (!__hsf_is_dot_entry(entry)) {
+                walk->visitor_cb(ctx, item->path, entry, payload);
+                
+                if (entry->file_flags & HSF_FILE_FLAG_IS_DIR) {
+                    Hsf_Walk_Item child;
+                    child.location = entry->data_location_le;
+                    child.length = entry->data_length_le;
+                    child.depth = item->depth + 1;
+                    
+                    HSF_LOCK(&walk->lock);
+                    if (child.depth > HSF_WALK_MAX_DEPTH || (child.length && !__hsf_key_set_insert(&walk->visited, child.location))) {
+                        walk->error = 1;
+                        HSF_UNLOCK(&walk->lock);
+                        offset += entry->length;
+                        continue;
+                    }
+                    
+                    // count it before it's stealable, otherwise a thief can finish it and take
+                    // pending to 0 while we're still scanning and the idle workers quit
+                    child.path = __hsf_walk_join_path(item->path, entry);
+                    walk->pending++;
+                    HSF_LOCK(&queue->lock);
+                    __hsf_walk_push(queue, child, walk->flags);
+                    HSF_UNLOCK(&queue->lock);
+                    walk->generation++;
+#ifdef HSF_INCLUDE_PTHREADS
+                    pthread_cond_broadcast(&walk->wake);
+#endif
+                    HSF_UNLOCK(&walk->lock);
+                }
+            }
+            
+            offset += entry->length;
+        }
+        
+        __hsf_free_buffer(ctx, buffer);
+    }
+    
+    void *__hsf_walk_worker(void *param) {
+        Hsf_Walk_Worker *worker = (Hsf_Walk_Worker *)param;
+        Hsf_Walk *walk = worker->walk;
+        
+        for (;;) {
+            HSF_LOCK(&walk->lock);
+            u32 generation = walk->generation;
+            HSF_UNLOCK(&walk->lock);
+            
+            Hsf_Walk_Item item;
+            int found = 0;
+            
+            Hsf_Walk_Queue *queue = &walk->queues[worker->index];
+            HSF_LOCK(&queue->lock);
+            found = __hsf_walk_pop(queue, &item, walk->flags);
+            HSF_UNLOCK(&queue->lock);
+            
+            for (u32 i = 1; !found && i < walk->queue_count; ++i) {
+                Hsf_Walk_Queue *victim = &walk->queues[(worker->index + i) % walk->queue_count];
+                HSF_LOCK(&victim->lock);
+                found = __hsf_walk_steal(victim, &item, walk->flags);
+                HSF_UNLOCK(&victim->lock);
+            }
+            
+            if (found) {
+                __hsf_walk_directory(walk, worker->index, &item);
+                HSF_FREE(item.path);
+                
+                HSF_LOCK(&walk->lock);
+                walk->pending--;
+#ifdef HSF_INCLUDE_PTHREADS
+                if (walk->pending == 0) pthread_cond_broadcast(&walk->wake);
+#endif
+                HSF_UNLOCK(&walk->lock);
+                continue;
+            }
+            
+            HSF_LOCK(&walk->lock);
+            if (walk->pending == 0) {
+                HSF_UNLOCK(&walk->lock);
+                break;
+            }
+            
+#ifdef HSF_INCLUDE_PTHREADS
+            // everything left is being read by someone else, sleep until they queue more or finish
+            if (walk->generation == generation) pthread_cond_wait(&walk->wake, &walk->lock);
+#else
+            (void)generation;
+#endif
+            HSF_UNLOCK(&walk->lock);
+        }
+        
+        return 0;
+    }
+    
+    int hsf_walk_tree(Hsf_Context *ctx, hsf_visitor_callback visitor_cb, void **thread_payloads, u32 thread_count, int flags) {
+        if (!ctx->pvd) return -1;
+        
+#ifndef HSF_INCLUDE_PTHREADS
+        thread_count = 1;
+#endif
+        if (thread_count == 0) thread_count = 1;
+        
+        Hsf_Walk walk;
+        __hsf_zero_memory(&walk, sizeof(Hsf_Walk));
+        walk.ctx = ctx;
+        walk.visitor_cb = visitor_cb;
+        walk.thread_payloads = thread_payloads;
+        walk.queue_count = thread_count;
+        walk.flags = flags;
+        
+        walk.queues = (Hsf_Walk_Queue *)HSF_ALLOC(sizeof(Hsf_Walk_Queue) * thread_count);
+        __hsf_zero_memory(walk.queues, sizeof(Hsf_Walk_Queue) * thread_count);
+        
+        Hsf_Walk_Worker *workers = (Hsf_Walk_Worker *)HSF_ALLOC(sizeof(Hsf_Walk_Worker) * thread_count);
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_mutex_init(&walk.lock, 0);
+        pthread_cond_init(&walk.wake, 0);
+        for (u32 i = 0; i < thread_count; ++i) pthread_mutex_init(&walk.queues[i].lock, 0);
+#endif
+        
+        Hsf_Walk_Item root;
+        root.location = ctx->pvd->root_directory_entry.data_location_le;
+        root.length = ctx->pvd->root_directory_entry.data_length_le;
+        root.depth = 0;
+        root.path = (char *)HSF_ALLOC(2);
+        root.path[0] = HSF_PATH_SEPARATOR;
+        root.path[1] = 0;
+        
+        __hsf_walk_push(&walk.queues[0], root, flags);
+        __hsf_key_set_insert(&walk.visited, root.location);
+        walk.pending = 1;
+        
+        for (u32 i = 0; i < thread_count; ++i) {
+            workers[i].walk = &walk;
+            workers[i].index = i;
+        }
+        
+#ifdef HSF_INCLUDE_PTHREADS
+        pthread_t *threads = (pthread_t *)HSF_ALLOC(sizeof(pthread_t) * thread_count);
+        u32 started = 1;
+        for (; started < thread_count; ++started) {
+            // if we can't get more threads the ones we have will still finish the walk
+            if (pthread_create(&threads[started], 0, __hsf_walk_worker, &workers[started]) != 0) break;
+        }
+        
+        __hsf_walk_worker(&workers[0]);
+        
+        for (u32 i = 1; i < started; ++i) pthread_join(threads[i], 0);
+        HSF_FREE(threads);
+        
+        for (u32 i = 0; i < thread_count; ++i) pthread_mutex_destroy(&walk.queues[i].lock);
+        pthread_cond_destroy(&walk.wake);
+        pthread_mutex_destroy(&walk.lock);
+#else
+        __hsf_walk_worker(&workers[0]);
+#endif
+        
+        for (u32 i = 0; i < thread_count; ++i) {
+            if (walk.queues[i].items) HSF_FREE(walk.queues[i].items);
+        }
+        
+        HSF_FREE(workers);
+        HSF_FREE(walk.queues);
+        __hsf_key_set_free(&walk.visited);
+        
+        return walk.error ? -1 : 0;
+    }
+    
+    u16 __hsf_swap_u16(u16 value) {
+        return (u16)((value >> 8) | (value << 8));
+    }
+    
+    u32 __hsf_swap_u32(u32 value) {
+        return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+    }
+    
+    typedef int (*hsf_sort_compare)(void *user, u32 a, u32 b);
+    
+    // stable bottom-up merge sort, directories and path tables can have far too many entries for
+    // anything quadratic
+    void __hsf_sort_u32(u32 *items, u32 count, hsf_sort_compare compare, void *user) {
+        if (count < 2) return;
+        
+        u32 *temp = (u32 *)HSF_ALLOC(sizeof(u32) * count);
+        u32 *src = items;
+        u32 *dst = temp;
+        
+        for (u32 width = 1; width < count; width *= 2) {
+            for (u32 start = 0; start < count; start += width * 2) {
+                u32 mid = (start + width < count) ? start + width : count;
+                u32 end = (start + width * 2 < count) ? start + width * 2 : count;
+                
+                u32 a = start;
+                u32 b = mid;
+                for (u32 i = start; i < end; ++i) {
+                    if (a < mid && (b >= end || compare(user, src[a], src[b]) <= 0)) {
+                        dst[i] = src[a++];
+                    } else {
+                        dst[i] = src[b++];
+                    }
+                }
+            }
+            
+            u32 *swap = src;
+            src = dst;
+            dst = swap;
+        }
+        
+        if (src != items) __hsf_memcpy(items, src, sizeof(u32) * count);
+        HSF_FREE(temp);
+    }
+    
+    int __hsf_compare_identifiers(const u8 *a, u32 a_length, const u8 *b, u32 b_length) {
+        u32 length = (a_length < b_length) ? a_length : b_length;
+        for (u32 i = 0; i < length; ++i) {
+            if (a[i] != b[i]) return (int)a[i] - (int)b[i];
+        }
+        
+        return (int)a_length - (int)b_length;
+    }
+    
+    // 33 + 221 is the longest even record that still fits the u8 record length
+#define HSF_MAX_IDENTIFIER_LENGTH 221
+    // ISO 9660 level 2, directories we create are held to it
+#define HSF_MAX_DIRECTORY_IDENTIFIER_LENGTH 31
+    // anything nested deeper than this is taken to be a directory that loops back on itself
+#define HSF_APPEND_MAX_DEPTH 255
+    
+    struct Hsf_Append_Dir
+    {
+        Hsf_Append_Dir *parent;
+        Hsf_Append_Dir *children; // subdirectories loaded so far, all of them once commit runs
+        Hsf_Append_Dir *next;
+        
+        u8 identifier[256];
+        u32 identifier_length;
+        u32 record_offset; // where this directory's record sits in parent->records
+        
+        // the directory's records minus '.' and '..', packed without sector padding
+        u8 *records;
+        u32 records_size;
+        u32 records_capacity;
+        
+        // filled in by hsf_append_commit
+        u32 *order;
+        u32 record_count;
+        u32 location;
+        u32 length;
+    };
+    
+    u32 __hsf_record_length(u32 identifier_length) {
+        // records have to be an even number of bytes long
+        return 33 + identifier_length + ((identifier_length % 2) ? 0 : 1);
+    }
+    
+    void __hsf_set_record_extent(Hsf_Directory_Entry *entry, u32 location, u32 length) {
+        entry->data_location_le = location;
+        entry->data_location_be = __hsf_swap_u32(location);
+        entry->data_length_le = length;
+        entry->data_length_be = __hsf_swap_u32(length);
+    }
+    
+    void __hsf_make_record(Hsf_Directory_Entry *entry, const u8 *identifier, u32 identifier_length, u32 location, u32 length, u8 flags, const Hsf_Time_Stamp *time_stamp) {
+        u32 record_length = __hsf_record_length(identifier_length);
+        __hsf_zero_memory(entry, record_length);
+        
+        entry->length = (u8)record_length;
+        __hsf_set_record_extent(entry, location, length);
+        entry->time_stamp = *time_stamp;
+        entry->file_flags = flags;
+        entry->volume_sequence_number_le = 1;
+        entry->volume_sequence_number_be = __hsf_swap_u16(1);
+        entry->filename_length = (u8)identifier_length;
+        __hsf_memcpy(&entry->filename[0], identifier, identifier_length);
+    }
+    
+    void __hsf_date_digits(char *digits, u32 count, u32 value) {
+        for (u32 i = count; i > 0; --i) {
+            digits[i - 1] = (char)('0' + value % 10);
+            value /= 10;
+        }
+    }
+    
+    void __hsf_time_stamp_to_date(const Hsf_Time_Stamp *time_stamp, Hsf_Date *date) {
+        __hsf_date_digits(date->year, 4, 1900 + (u32)time_stamp->years);
+        __hsf_date_digits(date->month, 2, time_stamp->month);
+        __hsf_date_digits(date->day, 2, time_stamp->day);
+        __hsf_date_digits(date->hour, 2, time_stamp->hour);
+        __hsf_date_digits(date->minute, 2, time_stamp->minute);
+        __hsf_date_digits(date->second, 2, time_stamp->second);
+        __hsf_date_digits(date->hundreths_of_second, 2, 0);
+        date->gmt_offset = time_stamp->gmt_offset;
+    }
+    
+    void __hsf_append_add_record(Hsf_Append_Dir *dir, Hsf_Directory_Entry *entry) {
+        if (dir->records_size + entry->length > dir->records_capacity) {
+            u32 capacity = dir->records_capacity ? dir->records_capacity * 2 : HSF_SECTOR_SIZE;
+            while (capacity < dir->records_size + entry->length) capacity *= 2;
+            
+            u8 *records = (u8 *)HSF_ALLOC(capacity);
+            if (dir->records) {
+                __hsf_memcpy(records, dir->records, dir->records_size);
+                HSF_FREE(dir->records);
+            }
+            
+            dir->records = records;
+            dir->records_capacity = capacity;
+        }
+        
+        __hsf_memcpy(dir->records + dir->records_size, entry, entry->length);
+        dir->records_size += entry->length;
+    }
+    
+    // name is matched without the ";1" version suffix, same as hsf_get_directory_entry does
+    Hsf_Directory_Entry *__hsf_append_find_record(Hsf_Append_Dir *dir, const u8 *name, u32 name_length) {
+        u32 offset = 0;
+        while (offset < dir->records_size) {
+            Hsf_Directory_Entry *entry = (Hsf_Directory_Entry *)(dir->records + offset);
+            
+            u32 length = __hsf_get_filename_length(entry);
+            if (__hsf_compare_identifiers((u8 *)&entry->filename[0], length, name, name_length) == 0) return entry;
+            
+            offset += entry->length;
+        }
+        
+        return 0;
+    }
+    
+    Hsf_Append_Dir *__hsf_append_load_dir(Hsf_Context *ctx, Hsf_Append_Dir *parent, const u8 *identifier, u32 identifier_length, u32 record_offset, u32 location, u32 length) {
+        Hsf_Append_Dir *dir = (Hsf_Append_Dir *)HSF_ALLOC(sizeof(Hsf_Append_Dir));
+        __hsf_zero_memory(dir, sizeof(Hsf_Append_Dir));
+        
+        dir->parent = parent;
+        dir->identifier_length = identifier_length;
+        dir->record_offset = record_offset;
+        __hsf_memcpy(dir->identifier, identifier, identifier_length);
+        
+        // new directories don't have an extent yet, they start out empty
+        if (length) {
+            u8 *buffer = (u8 *)__hsf_read_extent(ctx, location, length);
+            if (!buffer) {
+                HSF_FREE(dir);
+                return 0;
+            }
+            
+            u32 offset = 0;
+            while (offset < length) {
+                Hsf_Directory_Entry *entry = (Hsf_Directory_Entry *)(buffer + offset);
+                
+                if (entry->length == 0) {
+                    offset = (offset / HSF_SECTOR_SIZE + 1) * HSF_SECTOR_SIZE;
+                    continue;
+                }
+                
+                if (!__hsf_is_dot_entry(entry)) __hsf_append_add_record(dir, entry);
+                offset += entry->length;
+            }
+            
+            __hsf_free_buffer(ctx, buffer);
+        }
+        
+        if (parent) {
+            dir->next = parent->children;
+            parent->children = dir;
+        }
+        
+        return dir;
+    }
+    
+    void __hsf_append_free_dir(Hsf_Append_Dir *dir) {
+        Hsf_Append_Dir *child = dir->children;
+        while (child) {
+            Hsf_Append_Dir *next = child->next;
+            __hsf_append_free_dir(child);
+            child = next;
+        }
+        
+        if (dir->records) HSF_FREE(dir->records);
+        if (dir->order) HSF_FREE(dir->order);
+        HSF_FREE(dir);
+    }
+    
+    Hsf_Append_Dir *__hsf_append_enter_dir(Hsf_Append *append, Hsf_Append_Dir *dir, const u8 *name, u32 name_length) {
+        if (name_length == 0 || name_length > HSF_MAX_IDENTIFIER_LENGTH) return 0;
+        
+        for (Hsf_Append_Dir *child = dir->children; child; child = child->next) {
+            if (__hsf_compare_identifiers(child->identifier, child->identifier_length, name, name_length) == 0) return child;
+        }
+        
+        Hsf_Directory_Entry *entry = __hsf_append_find_record(dir, name, name_length);
+        if (entry) {
+            if (!(entry->file_flags & HSF_FILE_FLAG_IS_DIR)) return 0;
+            
+            u32 record_offset = (u32)((u8 *)entry - dir->records);
+            return __hsf_append_load_dir(append->ctx, dir, name, name_length, record_offset, entry->data_location_le, entry->data_length_le);
+        }
+        
+        if (name_length > HSF_MAX_DIRECTORY_IDENTIFIER_LENGTH) return 0;
+        
+        // the record's extent gets filled in once the directory is placed at commit time
+        u8 record[256];
+        u32 record_offset = dir->records_size;
+        __hsf_make_record((Hsf_Directory_Entry *)record, name, name_length, 0, 0, HSF_FILE_FLAG_IS_DIR, &append->time_stamp);
+        __hsf_append_add_record(dir, (Hsf_Directory_Entry *)record);
+        
+        return __hsf_append_load_dir(append->ctx, dir, name, name_length, record_offset, 0, 0);
+    }
+    
+    int hsf_append_begin(Hsf_Append *append, Hsf_Context *ctx, const Hsf_Time_Stamp *time_stamp) {
+        __hsf_zero_memory(append, sizeof(Hsf_Append));
+        if (ctx->io_mode != HSF_IO_READ_WRITE || !ctx->pvd) return -1;
+        
+        if (!time_stamp || time_stamp->month < 1 || time_stamp->month > 12 || time_stamp->day < 1 || time_stamp->day > 31) return -1;
+        if (time_stamp->hour > 23 || time_stamp->minute > 59 || time_stamp->second > 59) return -1;
+        
+        append->ctx = ctx;
+        append->session_start = ctx->pvd->volume_space_size_le;
+        // 16 sectors of system area, then the PVD and the set terminator
+        append->next_sector = append->session_start + 0x12;
+        
+        append->time_stamp = *time_stamp;
+        
+        Hsf_Directory_Entry *root = &ctx->pvd->root_directory_entry;
+        u8 root_identifier = 0;
+        append->root = __hsf_append_load_dir(ctx, 0, &root_identifier, 1, 0, root->data_location_le, root->data_length_le);
+        if (!append->root) return -1;
+        
+        return 0;
+    }
+    
+    void hsf_append_abort(Hsf_Append *append) {
+        if (append->root) __hsf_append_free_dir(append->root);
+        __hsf_zero_memory(append, sizeof(Hsf_Append));
+    }
+    
+    int hsf_append_file(Hsf_Append *append, const char *path, const void *data, u32 size) {
+        if (!append->root) return -1;
+        if (__hsf_is_valid_path(path) == -1) return -1;
+        
+        Hsf_Append_Dir *dir = append->root;
+        
+        const char *name = path;
+        while (*name == HSF_PATH_SEPARATOR) name++;
+        
+        for (;;) {
+            const char *end = name;
+            while (*end && *end != HSF_PATH_SEPARATOR) end++;
+            if (!*end) break;
+            
+            if (end != name) {
+                dir = __hsf_append_enter_dir(append, dir, (const u8 *)name, (u32)(end - name));
+                if (!dir) return -1;
+            }
+            
+            name = end + 1;
+        }
+        
+        u32 name_length = __hsf_strlen(name);
+        
+        // files are stored as NAME.EXT;1, level 1 wants the dot even without an extension
+        u8 identifier[256];
+        u32 identifier_length = name_length;
+        if (name_length == 0 || name_length > HSF_MAX_IDENTIFIER_LENGTH - 3) return -1;
+        __hsf_memcpy(identifier, name, name_length);
+        
+        int has_dot = 0;
+        for (u32 i = 0; i < name_length; ++i) {
+            if (name[i] == '.') has_dot = 1;
+        }
+        
+        if (!has_dot) identifier[identifier_length++] = '.';
+        identifier[identifier_length++] = ';';
+        identifier[identifier_length++] = '1';
+        
+        Hsf_Directory_Entry *entry = __hsf_append_find_record(dir, (const u8 *)name, name_length);
+        if (entry && (entry->file_flags & HSF_FILE_FLAG_IS_DIR)) return -1;
+        
+        u32 location = append->next_sector;
+        u32 whole_sectors = size / HSF_SECTOR_SIZE;
+        u32 tail = size % HSF_SECTOR_SIZE;
+        
+        if (whole_sectors) {
+            if (__hsf_write_sectors(append->ctx, location, whole_sectors, (void *)data) != 0) return -1;
+        }
+        
+        if (tail) {
+            void *last = HSF_ALLOC(HSF_SECTOR_SIZE);
+            __hsf_zero_memory(last, HSF_SECTOR_SIZE);
+            __hsf_memcpy(last, (const u8 *)data + (u64)whole_sectors * HSF_SECTOR_SIZE, tail);
+            
+            int result = __hsf_write_sectors(append->ctx, location + whole_sectors, 1, last);
+            HSF_FREE(last);
+            if (result != 0) return -1;
+        }
+        
+        append->next_sector += whole_sectors + (tail ? 1 : 0);
+        
+        if (entry) {
+            // the old extent is left where it is, it just isn't referenced anymore
+            __hsf_set_record_extent(entry, location, size);
+            entry->time_stamp = append->time_stamp;
+        } else {
+            u8 record[256];
+            __hsf_make_record((Hsf_Directory_Entry *)record, identifier, identifier_length, location, size, 0, &append->time_stamp);
+            __hsf_append_add_record(dir, (Hsf_Directory_Entry *)record);
+        }
+        
+        return 0;
+    }
+    
+    // Loads every directory on the image that isn't loaded yet. All of them go into the new
+    // session, not just the ones on the path to a changed file, otherwise '..' in an untouched
+    // subdirectory would still lead to its parent's old extent. File data isn't touched.
+    int __hsf_append_load_tree(Hsf_Context *ctx, Hsf_Append_Dir *dir, u32 depth) {
+        if (depth > HSF_APPEND_MAX_DEPTH) return -1;
+        
+        // only the directories loaded before this call can already have a record in here
+        Hsf_Append_Dir *loaded = dir->children;
+        
+        u32 offset = 0;
+        while (offset < dir->records_size) {
+            Hsf_Directory_Entry *entry = (Hsf_Directory_Entry *)(dir->records + offset);
+            
+            if (entry->file_flags & HSF_FILE_FLAG_IS_DIR) {
+                Hsf_Append_Dir *child = loaded;
+                while (child && child->record_offset != offset) child = child->next;
+                
+                if (!child) {
+                    child = __hsf_append_load_dir(ctx, dir, (u8 *)&entry->filename[0], entry->filename_length, offset, entry->data_location_le, entry->data_length_le);
+                    if (!child) return -1;
+                }
+            }
+            
+            offset += entry->length;
+        }
+        
+        for (Hsf_Append_Dir *child = dir->children; child; child = child->next) {
+            if (__hsf_append_load_tree(ctx, child, depth + 1) != 0) return -1;
+        }
+        
+        return 0;
+    }
+    
+    int __hsf_append_compare_records(void *user, u32 a, u32 b) {
+        u8 *records = (u8 *)user;
+        Hsf_Directory_Entry *entry_a = (Hsf_Directory_Entry *)(records + a);
+        Hsf_Directory_Entry *entry_b = (Hsf_Directory_Entry *)(records + b);
+        return __hsf_compare_identifiers((u8 *)&entry_a->filename[0], entry_a->filename_length, (u8 *)&entry_b->filename[0], entry_b->filename_length);
+    }
+    
+    u32 __hsf_append_place_record(u32 offset, u32 record_length) {
+        if ((offset % HSF_SECTOR_SIZE) + record_length > HSF_SECTOR_SIZE) {
+            offset = (offset / HSF_SECTOR_SIZE + 1) * HSF_SECTOR_SIZE;
+        }
+        
+        return offset;
+    }
+    
+    // sorts the records and works out how many bytes the directory's extent needs
+    void __hsf_append_layout_dir(Hsf_Append_Dir *dir) {
+        dir->record_count = 0;
+        for (u32 offset = 0; offset < dir->records_size; offset += dir->records[offset]) dir->record_count++;
+        
+        dir->order = (u32 *)HSF_ALLOC(sizeof(u32) * (dir->record_count ? dir->record_count : 1));
+        u32 index = 0;
+        for (u32 offset = 0; offset < dir->records_size; offset += dir->records[offset]) dir->order[index++] = offset;
+        
+        __hsf_sort_u32(dir->order, dir->record_count, __hsf_append_compare_records, dir->records);
+        
+        u32 used = __hsf_record_length(1) * 2;
+        for (u32 i = 0; i < dir->record_count; ++i) {
+            u32 record_length = dir->records[dir->order[i]];
+            used = __hsf_append_place_record(used, record_length) + record_length;
+        }
+        
+        dir->length = ((used + HSF_SECTOR_SIZE - 1) / HSF_SECTOR_SIZE) * HSF_SECTOR_SIZE;
+        
+        for (Hsf_Append_Dir *child = dir->children; child; child = child->next) {
+            __hsf_append_layout_dir(child);
+        }
+    }
+    
+    // parents get placed before their children, same as mastering tools do
+    u32 __hsf_append_place_dir(Hsf_Append_Dir *dir, u32 location) {
+        dir->location = location;
+        location += dir->length / HSF_SECTOR_SIZE;
+        
+        for (Hsf_Append_Dir *child = dir->children; child; child = child->next) {
+            location = __hsf_append_place_dir(child, location);
+            
+            Hsf_Directory_Entry *entry = (Hsf_Directory_Entry *)(dir->records + child->record_offset);
+            __hsf_set_record_extent(entry, child->location, child->length);
+        }
+        
+        return location;
+    }
+    
+    int __hsf_append_write_dir(Hsf_Context *ctx, Hsf_Append_Dir *dir, const Hsf_Time_Stamp *time_stamp) {
+        u8 *buffer = (u8 *)HSF_ALLOC(dir->length);
+        __hsf_zero_memory(buffer, dir->length);
+        
+        Hsf_Append_Dir *parent = dir->parent ? dir->parent : dir;
+        u8 dot = 0;
+        u8 dot_dot = 1;
+        
+        u32 offset = 0;
+        __hsf_make_record((Hsf_Directory_Entry *)(buffer + offset), &dot, 1, dir->location, dir->length, HSF_FILE_FLAG_IS_DIR, time_stamp);
+        offset += buffer[offset];
+        __hsf_make_record((Hsf_Directory_Entry *)(buffer + offset), &dot_dot, 1, parent->location, parent->length, HSF_FILE_FLAG_IS_DIR, time_stamp);
+        offset += buffer[offset];
+        
+        for (u32 i = 0; i < dir->record_count; ++i) {
+            u8 *record = dir->records + dir->order[i];
+            offset = __hsf_append_place_record(offset, record[0]);
+            __hsf_memcpy(buffer + offset, record, record[0]);
+            offset += record[0];
+        }
+        
+        int result = __hsf_write_sectors(ctx, dir->location, dir->length / HSF_SECTOR_SIZE, buffer);
+        HSF_FREE(buffer);
+        if (result != 0) return -1;
+        
+        for (Hsf_Append_Dir *child = dir->children; child; child = child->next) {
+            if (__hsf_append_write_dir(ctx, child, time_stamp) != 0) return -1;
+        }
+        
+        return 0;
+    }
+    
+    typedef struct
+    {
+        Hsf_Append_Dir *dir;
+        u32 parent; // index into the array, not the 1-based number stored on disc
+        u32 level;
+        u32 number;
+    } Hsf_Append_Path;
+    
+    u32 __hsf_append_count_dirs(Hsf_Append_Dir *dir) {
+        u32 count = 1;
+        for (Hsf_Append_Dir *child = dir->children; child; child = child->next) count += __hsf_append_count_dirs(child);
+        return count;
+    }
+    
+    void __hsf_append_fill_path_table(Hsf_Append_Path *paths, u32 *count, Hsf_Append_Dir *dir, u32 parent, u32 level) {
+        u32 index = (*count)++;
+        paths[index].dir = dir;
+        paths[index].parent = parent;
+        paths[index].level = level;
+        
+        for (Hsf_Append_Dir *child = dir->children; child; child = child->next) {
+            __hsf_append_fill_path_table(paths, count, child, index, level + 1);
+        }
+    }
+    
+    int __hsf_append_compare_paths(void *user, u32 a, u32 b) {
+        Hsf_Append_Path *paths = (Hsf_Append_Path *)user;
+        Hsf_Append_Path *path_a = &paths[a];
+        Hsf_Append_Path *path_b = &paths[b];
+        
+        if (path_a->level != path_b->level) return (path_a->level < path_b->level) ? -1 : 1;
+        
+        // parents of this level were numbered in the previous pass
+        u32 parent_a = paths[path_a->parent].number;
+        u32 parent_b = paths[path_b->parent].number;
+        if (parent_a != parent_b) return (parent_a < parent_b) ? -1 : 1;
+        
+        return __hsf_compare_identifiers(path_a->dir->identifier, path_a->dir->identifier_length, path_b->dir->identifier, path_b->dir->identifier_length);
+    }
+    
+    u32 __hsf_append_path_record_length(Hsf_Append_Path *path) {
+        return 8 + path->dir->identifier_length + (path->dir->identifier_length % 2);
+    }
+    
+    typedef struct
+    {
+        Hsf_Append_Path *paths;
+        u32 path_count;
+        u32 *order;
+        u8 *table_buffer;
+        Hsf_Primary_Volume_Descriptor *pvd;
+    } Hsf_Append_Commit;
+    
+    int __hsf_append_write_session(Hsf_Append *append, Hsf_Append_Commit *commit) {
+        Hsf_Context *ctx = append->ctx;
+        
+        if (__hsf_append_load_tree(ctx, append->root, 0) != 0) return -1;
+        
+        u32 dir_count = __hsf_append_count_dirs(append->root);
+        if (dir_count > 0xFFFF) return -1; // parent numbers are 16 bit
+        
+        commit->paths = (Hsf_Append_Path *)HSF_ALLOC(sizeof(Hsf_Append_Path) * dir_count);
+        __hsf_zero_memory(commit->paths, sizeof(Hsf_Append_Path) * dir_count);
+        __hsf_append_fill_path_table(commit->paths, &commit->path_count, append->root, 0, 1);
+        
+        commit->order = (u32 *)HSF_ALLOC(sizeof(u32) * commit->path_count);
+        for (u32 i = 0; i < commit->path_count; ++i) commit->order[i] = i;
+        
+        // number the table a level at a time, the sort key includes the parent's number
+        u32 numbered = 0;
+        while (numbered < commit->path_count) {
+            __hsf_sort_u32(commit->order + numbered, commit->path_count - numbered, __hsf_append_compare_paths, commit->paths);
+            
+            u32 level = commit->paths[commit->order[numbered]].level;
+            while (numbered < commit->path_count && commit->paths[commit->order[numbered]].level == level) {
+                commit->paths[commit->order[numbered]].number = numbered + 1;
+                numbered++;
+            }
+        }
+        
+        u32 table_size = 0;
+        for (u32 i = 0; i < commit->path_count; ++i) table_size += __hsf_append_path_record_length(&commit->paths[i]);
+        u32 table_sectors = (table_size / HSF_SECTOR_SIZE) + ((table_size % HSF_SECTOR_SIZE) ? 1 : 0);
+        
+        // path tables, then directories, right after the file data of this session
+        __hsf_append_layout_dir(append->root);
+        
+        u32 table_location_le = append->next_sector;
+        u32 table_location_be = table_location_le + table_sectors;
+        u32 end = __hsf_append_place_dir(append->root, table_location_be + table_sectors);
+        
+        commit->table_buffer = (u8 *)HSF_ALLOC((u64)(table_sectors ? table_sectors : 1) * HSF_SECTOR_SIZE);
+        
+        for (int big_endian = 0; big_endian < 2; ++big_endian) {
+            __hsf_zero_memory(commit->table_buffer, (u64)table_sectors * HSF_SECTOR_SIZE);
+            
+            u32 offset = 0;
+            for (u32 i = 0; i < commit->path_count; ++i) {
+                Hsf_Append_Path *path = &commit->paths[commit->order[i]];
+                Hsf_Path_Table_Entry *entry = (Hsf_Path_Table_Entry *)(commit->table_buffer + offset);
+                
+                u16 parent_number = (u16)commit->paths[path->parent].number;
+                entry->identifier_length = (u8)path->dir->identifier_length;
+                entry->extent_location = big_endian ? __hsf_swap_u32(path->dir->location) : path->dir->location;
+                entry->parent_directory_index = big_endian ? __hsf_swap_u16(parent_number) : parent_number;
+                __hsf_memcpy(&entry->identifier[0], path->dir->identifier, path->dir->identifier_length);
+                
+                offset += __hsf_append_path_record_length(path);
+            }
+            
+            u32 location = big_endian ? table_location_be : table_location_le;
+            if (__hsf_write_sectors(ctx, location, table_sectors, commit->table_buffer) != 0) return -1;
+        }
+        
+        if (__hsf_append_write_dir(ctx, append->root, &append->time_stamp) != 0) return -1;
+        
+        Hsf_Primary_Volume_Descriptor *pvd = (Hsf_Primary_Volume_Descriptor *)HSF_ALLOC(HSF_SECTOR_SIZE);
+        commit->pvd = pvd;
+        __hsf_memcpy(pvd, ctx->pvd, HSF_SECTOR_SIZE);
+        
+        pvd->volume_space_size_le = end;
+        pvd->volume_space_size_be = __hsf_swap_u32(end);
+        pvd->path_table_size_le = table_size;
+        pvd->path_table_size_be = __hsf_swap_u32(table_size);
+        pvd->path_table_location_le = table_location_le;
+        pvd->optional_path_table_location_le = 0;
+        pvd->path_table_location_be = __hsf_swap_u32(table_location_be);
+        pvd->optional_path_table_location_be = 0;
+        __hsf_set_record_extent(&pvd->root_directory_entry, append->root->location, append->root->length);
+        pvd->root_directory_entry.time_stamp = append->time_stamp;
+        __hsf_time_stamp_to_date(&append->time_stamp, &pvd->volume_modification_date);
+        
+        // the terminator goes out first, the session only becomes visible once the PVD lands
+        Hsf_Volume_Descriptor *terminator = (Hsf_Volume_Descriptor *)commit->table_buffer;
+        __hsf_zero_memory(terminator, HSF_SECTOR_SIZE);
+        terminator->type = HSF_VD_TYPE_VDST;
+        __hsf_memcpy(&terminator->id[0], HSF_VD_ID, 5);
+        terminator->version = 1;
+        
+        if (__hsf_write_sectors(ctx, append->session_start + 0x11, 1, terminator) != 0) return -1;
+        if (__hsf_write_sectors(ctx, append->session_start + 0x10, 1, pvd) != 0) return -1;
+        
         return 0;
     }
     
-    int hsf_file_read(void *buffer, u64 count_bytes, Hsf_File *file) {
-        Hsf_Context *ctx = file->ctx;
+    int hsf_append_commit(Hsf_Append *append) {
+        if (!append->root) return -1;
         
-        u32 sector_start = file->directory_entry->data_location_le + (file->seek_position / HSF_SECTOR_SIZE);
-        u32 num_sectors = (count_bytes / HSF_SECTOR_SIZE) + ((count_bytes % HSF_SECTOR_SIZE) ? 1 : 0);
+        Hsf_Append_Commit commit;
+        __hsf_zero_memory(&commit, sizeof(Hsf_Append_Commit));
         
-        void *temp = HSF_ALLOC(HSF_SECTOR_SIZE * num_sectors);
-        int result = __hsf_read_sectors(ctx, sector_start, num_sectors, temp);
-        if (result != 0) {
-            HSF_FREE(temp);
-            return -1;
+        int result = __hsf_append_write_session(append, &commit);
+        if (result == 0) {
+            HSF_FREE(append->ctx->pvd);
+            append->ctx->pvd = commit.pvd;
+            commit.pvd = 0;
         }
         
-        u32 start = file->seek_position % HSF_SECTOR_SIZE;
-        __hsf_memcpy(buffer, ((char *)temp) + start, count_bytes);
-        
-        file->seek_position += count_bytes;
-        HSF_FREE(temp);
+        if (commit.pvd) HSF_FREE(commit.pvd);
+        if (commit.table_buffer) HSF_FREE(commit.table_buffer);
+        if (commit.order) HSF_FREE(commit.order);
+        if (commit.paths) HSF_FREE(commit.paths);
         
-        return 0;
+        hsf_append_abort(append);
+        return result;
     }
     
-    void *hsf_get_sector(Hsf_Context *ctx, u32 sector) {
-        void *buffer = HSF_ALLOC(HSF_SECTOR_SIZE);
-        int result = __hsf_read_sectors(ctx, sector, 1, buffer);
-        if (result != 0) {
-            HSF_FREE(buffer);
-            return 0;
+    typedef struct
+    {
+        u32 location;
+        u32 length;
+        u32 received;
+        char *path;
+        Hsf_Directory_Entry *entry; // files only
+        u8 *buffer;                 // directories only, filled in as the extent streams past
+        int is_directory;
+        
+        // contiguous file bytes that haven't been handed to the callback yet
+        u8 *run;
+        u32 run_offset;
+        u32 run_bytes;
+    } Hsf_Stream_Extent;
+    
+    typedef struct
+    {
+        hsf_stream_file_callback file_cb;
+        void *file_payload;
+        
+        Hsf_Stream_Extent **pending; // min-heap on location, extents we haven't reached yet
+        u32 pending_count;
+        u32 pending_capacity;
+        
+        Hsf_Stream_Extent **active;
+        u32 active_count;
+        u32 active_capacity;
+        
+        Hsf_Stream_Extent **completed;
+        u32 completed_count;
+        u32 completed_capacity;
+        
+        // Sectors nobody claimed when they went by, oldest first. Directories that show up later
+        // in the stream can still point back into these, they're dropped once over budget.
+        u8 **held;
+        u32 *held_lba;
+        u32 held_capacity;
+        u32 held_start;
+        u32 held_count;
+        
+        // held sectors and directory buffers both count against the budget
+        u64 memory_budget;
+        u64 memory_used;
+        
+        int found_pvd;
+        int missed; // some extent's data was dropped before we knew we needed it
+        int error;
+        
+        // where a newer session's PVD would be, the current one's volume space size + 16
+        u64 next_pvd_lba;
+        u32 volume_space_size;
+        
+        // files handed out in full so far, keyed by __hsf_stream_file_key, so a later session
+        // doesn't deliver the ones it shares with an earlier one again
+        Hsf_Key_Set delivered;
+    } Hsf_Stream;
+    
+    void __hsf_stream_push(Hsf_Stream_Extent ***items, u32 *count, u32 *capacity, Hsf_Stream_Extent *extent) {
+        if (*count == *capacity) {
+            u32 new_capacity = *capacity ? *capacity * 2 : 64;
+            Hsf_Stream_Extent **new_items = (Hsf_Stream_Extent **)HSF_ALLOC(sizeof(Hsf_Stream_Extent *) * new_capacity);
+            if (*items) {
+                __hsf_memcpy(new_items, *items, sizeof(Hsf_Stream_Extent *) * *count);
+                HSF_FREE(*items);
+            }
+            
+            *items = new_items;
+            *capacity = new_capacity;
         }
-        return buffer;
+        
+        (*items)[(*count)++] = extent;
     }
     
-    Hsf_Primary_Volume_Descriptor *hsf_get_primary_volume_descriptor(Hsf_Context *ctx) {
-        void *buffer = hsf_get_sector(ctx, 0x10);
-        return (Hsf_Primary_Volume_Descriptor *)buffer;
+    void __hsf_stream_push_pending(Hsf_Stream *stream, Hsf_Stream_Extent *extent) {
+        __hsf_stream_push(&stream->pending, &stream->pending_count, &stream->pending_capacity, extent);
+        
+        Hsf_Stream_Extent **heap = stream->pending;
+        u32 index = stream->pending_count - 1;
+        while (index) {
+            u32 parent = (index - 1) / 2;
+            if (heap[parent]->location <= heap[index]->location) break;
+            
+            Hsf_Stream_Extent *temp = heap[parent];
+            heap[parent] = heap[index];
+            heap[index] = temp;
+            index = parent;
+        }
     }
     
-    int __hsf_parse_next_path_identifier(const char *path, int start_offset) {
-        u32 path_len = __hsf_strlen(path);
-        if (start_offset >= path_len) return path_len;
-        
-        const char *start = path + start_offset;
-        u32 length = __hsf_strlen(start);
+    Hsf_Stream_Extent *__hsf_stream_pop_pending(Hsf_Stream *stream) {
+        Hsf_Stream_Extent **heap = stream->pending;
+        Hsf_Stream_Extent *out = heap[0];
+        heap[0] = heap[--stream->pending_count];
         
-        for (u32 i = 0; i < length; ++i) {
-            char c = start[i];
+        u32 index = 0;
+        for (;;) {
+            u32 smallest = index;
+            u32 left = index * 2 + 1;
+            u32 right = left + 1;
             
-            if (c == HSF_PATH_SEPARATOR) {
-                return start_offset + i;
-            } else if (__hsf_is_dchar_set(c)) {
-                continue;
-            } else {
-                return -1;
-            }
+            if (left < stream->pending_count && heap[left]->location < heap[smallest]->location) smallest = left;
+            if (right < stream->pending_count && heap[right]->location < heap[smallest]->location) smallest = right;
+            if (smallest == index) break;
+            
+            Hsf_Stream_Extent *temp = heap[smallest];
+            heap[smallest] = heap[index];
+            heap[index] = temp;
+            index = smallest;
         }
         
-        return start_offset + length;
+        return out;
     }
     
-    int __hsf_is_valid_path(const char *filename) {
-        if (!filename) return -1;
+    u8 *__hsf_stream_take_oldest(Hsf_Stream *stream) {
+        u8 *buffer = stream->held[stream->held_start];
+        stream->held_start = (stream->held_start + 1) % stream->held_capacity;
+        stream->held_count--;
+        return buffer;
+    }
+    
+    void __hsf_stream_hold(Hsf_Stream *stream, u32 lba, u8 *sector) {
+        if (stream->held_capacity == 0) return;
         
-        while (*filename) {
-            char c = *filename;
-            if (!(c == HSF_PATH_SEPARATOR || __hsf_is_dchar_set(c)) ) return -1;
-            filename++;
+        u8 *buffer;
+        if (stream->memory_used + HSF_SECTOR_SIZE > stream->memory_budget) {
+            // out of budget, the oldest held sector makes way
+            if (stream->held_count == 0) return;
+            buffer = __hsf_stream_take_oldest(stream);
+        } else {
+            buffer = (u8 *)HSF_ALLOC(HSF_SECTOR_SIZE);
+            stream->memory_used += HSF_SECTOR_SIZE;
+        }
+        
+        u32 index = (stream->held_start + stream->held_count) % stream->held_capacity;
+        stream->held[index] = buffer;
+        stream->held_lba[index] = lba;
+        __hsf_memcpy(buffer, sector, HSF_SECTOR_SIZE);
+        stream->held_count++;
+    }
+    
+    // Reserves bytes of the budget for a directory buffer, dropping held sectors to make room.
+    // Returns 0 if it doesn't fit even with nothing held.
+    int __hsf_stream_charge(Hsf_Stream *stream, u64 bytes) {
+        while (stream->memory_used + bytes > stream->memory_budget && stream->held_count) {
+            HSF_FREE(__hsf_stream_take_oldest(stream));
+            stream->memory_used -= HSF_SECTOR_SIZE;
+        }
+        
+        if (stream->memory_used + bytes > stream->memory_budget) return 0;
+        
+        stream->memory_used += bytes;
+        return 1;
+    }
+    
+    u8 *__hsf_stream_find_held(Hsf_Stream *stream, u32 lba) {
+        // held sectors are in stream order, so sorted by LBA
+        u32 low = 0;
+        u32 high = stream->held_count;
+        while (low < high) {
+            u32 mid = low + (high - low) / 2;
+            u32 index = (stream->held_start + mid) % stream->held_capacity;
+            
+            if (stream->held_lba[index] == lba) return stream->held[index];
+            if (stream->held_lba[index] < lba) low = mid + 1;
+            else high = mid;
         }
         
         return 0;
     }
     
-    u32 __hsf_get_filename_length(Hsf_Directory_Entry *entry) {
-        u32 max = entry->filename_length;
+    void __hsf_stream_flush(Hsf_Stream *stream, Hsf_Stream_Extent *extent) {
+        if (!extent->run) return;
         
-        for (u32 i = 0; i <= max; ++i) {
-            char c = entry->filename[i];
+        stream->file_cb(extent->path, extent->entry, extent->run, extent->run_bytes, extent->run_offset, stream->file_payload);
+        extent->run = 0;
+        extent->run_bytes = 0;
+    }
+    
+    // returns 1 once the whole extent has been seen
+    int __hsf_stream_consume(Hsf_Stream *stream, Hsf_Stream_Extent *extent, u8 *sector) {
+        u32 bytes = extent->length - extent->received;
+        if (bytes > HSF_SECTOR_SIZE) bytes = HSF_SECTOR_SIZE;
+        
+        if (extent->buffer) {
+            __hsf_memcpy(extent->buffer + extent->received, sector, bytes);
+        } else {
+            if (extent->run && extent->run + extent->run_bytes != sector) __hsf_stream_flush(stream, extent);
             
-            if (c == '.' && i < max) {
-                char d = entry->filename[i+1];
-                if (d == ';') return i;
+            if (!extent->run) {
+                extent->run = sector;
+                extent->run_offset = extent->received;
             }
             
-            // @FixMe -1 hwew is potentially very bad if i == 0, but maybe that never happens, i dunno man.
-            if (c == ';') return i;
+            extent->run_bytes += bytes;
         }
         
-        return max;
+        extent->received += bytes;
+        return extent->received == extent->length;
     }
     
-    Hsf_Directory_Entry *hsf_get_directory_entry(Hsf_Context *ctx, const char *filename) {
-        if (__hsf_is_valid_path(filename) == -1) return 0;
-        
-        int offset = __hsf_parse_next_path_identifier(filename, 0);
-        if (offset == -1) return 0;
+    // a file is the same one again if it has the same path and data
+    u64 __hsf_stream_file_key(const char *path, u32 location, u32 length) {
+        u32 hash = 2166136261u;
+        for (const char *c = path; *c; ++c) hash = (hash ^ (u8)*c) * 16777619u;
         
-        int name_end = __hsf_parse_next_path_identifier(filename, offset + 2);
-        
-        void *buffer = hsf_get_sector(ctx, ctx->pvd->root_directory_entry.data_location_le);
-        if (!buffer) return 0;
+        return ((u64)location << 32) | (hash ^ length);
+    }
+    
+    void __hsf_stream_free_extent(Hsf_Stream *stream, Hsf_Stream_Extent *extent) {
+        if (extent->path) HSF_FREE(extent->path);
+        if (extent->entry) HSF_FREE(extent->entry);
+        if (extent->buffer) {
+            HSF_FREE(extent->buffer);
+            stream->memory_used -= extent->length;
+        }
         
-        Hsf_Directory_Entry *re = (Hsf_Directory_Entry *)buffer;
+        HSF_FREE(extent);
+    }
+    
+    void __hsf_stream_add_extent(Hsf_Stream *stream, Hsf_Stream_Extent *extent, u32 next_lba);
+    
+    // Directory buffers only come out of the budget once the stream gets to the extent, a wide
+    // tree can have far more directories queued up than it needs buffers for at any one time.
+    int __hsf_stream_activate(Hsf_Stream *stream, Hsf_Stream_Extent *extent) {
+        if (!extent->is_directory || extent->buffer) return 1;
         
-        if (name_end == 1) {
-            return re;
+        if (!__hsf_stream_charge(stream, extent->length)) {
+            stream->error = 1;
+            __hsf_stream_free_extent(stream, extent);
+            return 0;
         }
         
-        offset = 1;
-        
-        int index_current = 0;
-        // @TODO handle the case that you need > 2048 bytes
-        int index_max = re->data_length_le;
+        extent->buffer = (u8 *)HSF_ALLOC((u64)extent->length);
+        return 1;
+    }
+    
+    void __hsf_stream_finish(Hsf_Stream *stream, Hsf_Stream_Extent *extent, u32 next_lba) {
+        if (!extent->is_directory) {
+            __hsf_stream_flush(stream, extent);
+            __hsf_key_set_insert(&stream->delivered, __hsf_stream_file_key(extent->path, extent->location, extent->length));
+            __hsf_stream_free_extent(stream, extent);
+            return;
+        }
         
-        while (index_current < index_max) {
-            if (re->length == 0) break;
-            if (name_end == offset) break;
+        u32 offset = 0;
+        while (offset < extent->length) {
+            Hsf_Directory_Entry *entry = (Hsf_Directory_Entry *)(extent->buffer + offset);
             
-            u32 length = name_end - offset;
-            u32 filename_len = __hsf_get_filename_length(re); 
+            if (entry->length == 0) {
+                offset = (offset / HSF_SECTOR_SIZE + 1) * HSF_SECTOR_SIZE;
+                continue;
+            }
             
-            if (length == filename_len) {
-                if (__hsf_strncmp(&re->filename[0], filename + offset, length) == 0) {
-                    if (re->file_flags & HSF_FILE_FLAG_IS_DIR) {
-                        offset = name_end + 1;
-                        name_end = __hsf_parse_next_path_identifier(filename, offset);
-                        
-                        void *new_sector = hsf_get_sector(ctx, re->data_location_le);
-                        HSF_FREE(buffer);
-                        if (!new_sector) return 0;
-                        
-                        buffer = new_sector;
-                        re = (Hsf_Directory_Entry *)buffer;
-                        index_current = 0;
-                        index_max = re->data_length_le;
-                        
-                        if (name_end <= offset) {
-                            return re;
-                        }
-                        
-                        continue;
-                    } else {
-                        offset = name_end + 1;
-                        name_end = __hsf_parse_next_path_identifier(filename, offset);
-                        
-                        if (name_end <= offset) {
-                            Hsf_Directory_Entry *out = (Hsf_Directory_Entry *)HSF_ALLOC(re->length);
-                            __hsf_memcpy(out, re, re->length);
-                            HSF_FREE(buffer);
-                            return (Hsf_Directory_Entry *)out;
-                        } else {
-                            break; // there's more in the path so the path may be invalid after this point
-                        }
-                    }
+            if (!__hsf_is_dot_entry(entry)) {
+                char *path = __hsf_walk_join_path(extent->path, entry);
+                
+                // an earlier session already delivered this exact file
+                if (!(entry->file_flags & HSF_FILE_FLAG_IS_DIR) &&
+                    __hsf_key_set_contains(&stream->delivered, __hsf_stream_file_key(path, entry->data_location_le, entry->data_length_le))) {
+                    HSF_FREE(path);
+                    offset += entry->length;
+                    continue;
+                }
+                
+                Hsf_Stream_Extent *child = (Hsf_Stream_Extent *)HSF_ALLOC(sizeof(Hsf_Stream_Extent));
+                __hsf_zero_memory(child, sizeof(Hsf_Stream_Extent));
+                child->location = entry->data_location_le;
+                child->length = entry->data_length_le;
+                child->path = path;
+                
+                if (entry->file_flags & HSF_FILE_FLAG_IS_DIR) {
+                    child->is_directory = 1;
+                } else {
+                    child->entry = (Hsf_Directory_Entry *)HSF_ALLOC(entry->length);
+                    __hsf_memcpy(child->entry, entry, entry->length);
                 }
+                
+                __hsf_stream_add_extent(stream, child, next_lba);
             }
             
-            index_current += re->length;
-            re = (Hsf_Directory_Entry *)((u8 *)re + re->length);
+            offset += entry->length;
         }
         
-        HSF_FREE(buffer);
-        return 0;
+        __hsf_stream_free_extent(stream, extent);
     }
     
-    Hsf_File *hsf_file_open(Hsf_Context *ctx, const char *filename) {
-        Hsf_File *file = (Hsf_File *)HSF_ALLOC(sizeof(Hsf_File));
-        file->ctx = ctx;
-        file->directory_entry = hsf_get_directory_entry(ctx, filename);
-        file->seek_position = 0;
+    void __hsf_stream_add_extent(Hsf_Stream *stream, Hsf_Stream_Extent *extent, u32 next_lba) {
+        if (extent->length == 0) {
+            if (extent->entry) {
+                stream->file_cb(extent->path, extent->entry, 0, 0, 0, stream->file_payload);
+                __hsf_key_set_insert(&stream->delivered, __hsf_stream_file_key(extent->path, extent->location, 0));
+            }
+            
+            __hsf_stream_free_extent(stream, extent);
+            return;
+        }
         
-        // File not found
-        if (!file->directory_entry)  {
-            HSF_FREE(file);
-            return 0;
+        if (extent->location >= next_lba) {
+            __hsf_stream_push_pending(stream, extent);
+            return;
         }
         
-        return file;
+        // this one already went past, everything we missed of it has to still be held
+        u32 sector_count = (extent->length / HSF_SECTOR_SIZE) + ((extent->length % HSF_SECTOR_SIZE) ? 1 : 0);
+        u32 end = extent->location + sector_count;
+        if (end > next_lba) end = next_lba;
+        
+        for (u32 lba = extent->location; lba < end; ++lba) {
+            if (!__hsf_stream_find_held(stream, lba)) {
+                stream->missed = 1;
+                __hsf_stream_free_extent(stream, extent);
+                return;
+            }
+        }
+        
+        // making room can drop held sectors, so check again afterwards
+        if (!__hsf_stream_activate(stream, extent)) return;
+        for (u32 lba = extent->location; lba < end; ++lba) {
+            if (!__hsf_stream_find_held(stream, lba)) {
+                stream->missed = 1;
+                __hsf_stream_free_extent(stream, extent);
+                return;
+            }
+        }
+        
+        int complete = 0;
+        for (u32 lba = extent->location; lba < end; ++lba) {
+            complete = __hsf_stream_consume(stream, extent, __hsf_stream_find_held(stream, lba));
+        }
+        
+        // the held sectors can be recycled before we come back to this extent
+        __hsf_stream_flush(stream, extent);
+        
+        if (complete) {
+            __hsf_stream_finish(stream, extent, next_lba);
+        } else {
+            __hsf_stream_push(&stream->active, &stream->active_count, &stream->active_capacity, extent);
+        }
     }
     
-    void hsf_file_close(Hsf_File *file) {
-        HSF_FREE(file->directory_entry);
-        HSF_FREE(file);
+    // starts on the tree of the session whose PVD this is
+    void __hsf_stream_begin_session(Hsf_Stream *stream, u32 lba, Hsf_Primary_Volume_Descriptor *pvd) {
+        stream->found_pvd = 1;
+        stream->volume_space_size = pvd->volume_space_size_le;
+        stream->next_pvd_lba = (u64)pvd->volume_space_size_le + 0x10;
+        
+        Hsf_Stream_Extent *root = (Hsf_Stream_Extent *)HSF_ALLOC(sizeof(Hsf_Stream_Extent));
+        __hsf_zero_memory(root, sizeof(Hsf_Stream_Extent));
+        root->location = pvd->root_directory_entry.data_location_le;
+        root->length = pvd->root_directory_entry.data_length_le;
+        root->path = (char *)HSF_ALLOC(2);
+        root->path[0] = HSF_PATH_SEPARATOR;
+        root->path[1] = 0;
+        root->is_directory = 1;
+        
+        __hsf_stream_add_extent(stream, root, lba + 1);
     }
     
-    void hsf_file_seek(Hsf_File *file, u32 offset, int seek_type) {
-        // @FixMe this is unsafe because we dont range-check Offset
-        if (seek_type == HSF_SEEK_SET) {
-            file->seek_position = offset;
-        } else if (seek_type == HSF_SEEK_CUR) {
-            file->seek_position += offset;
-        } else if (seek_type == HSF_SEEK_END) {
-            file->seek_position = file->directory_entry->data_length_le - offset;
+    void __hsf_stream_sector(Hsf_Stream *stream, u32 lba, u8 *sector) {
+        if (!stream->found_pvd) {
+            if (lba < 0x10) return;
+            
+            Hsf_Volume_Descriptor *descriptor = (Hsf_Volume_Descriptor *)sector;
+            if (__hsf_strncmp(&descriptor->id[0], HSF_VD_ID, 5) != 0 || descriptor->type == HSF_VD_TYPE_VDST) {
+                stream->error = 1;
+                return;
+            }
+            
+            if (descriptor->type == HSF_VD_TYPE_PVD) __hsf_stream_begin_session(stream, lba, (Hsf_Primary_Volume_Descriptor *)sector);
+            return;
         }
+        
+        if (lba == stream->next_pvd_lba) {
+            // same test hsf_create_context uses to follow the session chain
+            Hsf_Primary_Volume_Descriptor *pvd = (Hsf_Primary_Volume_Descriptor *)sector;
+            if (pvd->type == HSF_VD_TYPE_PVD && __hsf_strncmp(&pvd->id[0], HSF_VD_ID, 5) == 0 &&
+                pvd->volume_space_size_le > stream->volume_space_size) {
+                __hsf_stream_begin_session(stream, lba, pvd);
+                return;
+            }
+        }
+        
+        while (stream->pending_count && stream->pending[0]->location <= lba) {
+            Hsf_Stream_Extent *extent = __hsf_stream_pop_pending(stream);
+            if (!__hsf_stream_activate(stream, extent)) return;
+            __hsf_stream_push(&stream->active, &stream->active_count, &stream->active_capacity, extent);
+        }
+        
+        if (stream->active_count == 0) {
+            __hsf_stream_hold(stream, lba, sector);
+            return;
+        }
+        
+        for (u32 i = 0; i < stream->active_count;) {
+            Hsf_Stream_Extent *extent = stream->active[i];
+            
+            if (__hsf_stream_consume(stream, extent, sector)) {
+                stream->active[i] = stream->active[--stream->active_count];
+                __hsf_stream_push(&stream->completed, &stream->completed_count, &stream->completed_capacity, extent);
+            } else {
+                ++i;
+            }
+        }
+        
+        // finishing a directory can add extents, so don't do it while walking the active list
+        for (u32 i = 0; i < stream->completed_count; ++i) {
+            __hsf_stream_finish(stream, stream->completed[i], lba + 1);
+        }
+        
+        stream->completed_count = 0;
     }
     
-    u32 hsf_file_tell(Hsf_File *file) {
-        return file->seek_position;
-    }
-    
-    void hsf_visit_directory(Hsf_Context *ctx, const char *dir_path, hsf_visitor_callback visitor_callback, void *user_payload) {
-        Hsf_Directory_Entry *entry = hsf_get_directory_entry(ctx, dir_path);
+    int hsf_stream_extract(hsf_stream_read_callback read_cb, void *read_payload, hsf_stream_file_callback file_cb, void *file_payload, u64 memory_budget) {
+        Hsf_Stream stream;
+        __hsf_zero_memory(&stream, sizeof(Hsf_Stream));
+        stream.file_cb = file_cb;
+        stream.file_payload = file_payload;
         
-        if (entry) {
-            Hsf_Directory_Entry *entry_memory = entry;
-            int index_current = 0;
-            int index_max = entry->data_length_le;
+        stream.memory_budget = memory_budget;
+        stream.held_capacity = (u32)(memory_budget / HSF_SECTOR_SIZE);
+        if (stream.held_capacity) {
+            stream.held = (u8 **)HSF_ALLOC(sizeof(u8 *) * stream.held_capacity);
+            stream.held_lba = (u32 *)HSF_ALLOC(sizeof(u32) * stream.held_capacity);
+        }
+        
+        const u32 chunk_sectors = 32;
+        u8 *chunk = (u8 *)HSF_ALLOC(chunk_sectors * HSF_SECTOR_SIZE);
+        
+        u32 lba = 0;
+        int ended = 0;
+        while (!stream.error && !ended) {
+            // a newer session's PVD can still follow
+            if (stream.found_pvd && stream.pending_count == 0 && stream.active_count == 0 && lba > stream.next_pvd_lba) break;
             
-            while (index_current < index_max) {
-                if (entry->length == 0) break;
-                
-                visitor_callback(ctx, dir_path, entry, user_payload);
+            u32 filled = 0;
+            while (filled < chunk_sectors * HSF_SECTOR_SIZE) {
+                int result = read_cb(read_payload, chunk + filled, chunk_sectors * HSF_SECTOR_SIZE - filled);
+                if (result < 0) stream.error = 1;
+                if (result <= 0) {
+                    ended = 1;
+                    break;
+                }
                 
-                index_current+= entry->length;
-                entry = (Hsf_Directory_Entry *)((u8 *)entry + entry->length);
+                filled += (u32)result;
             }
             
-            HSF_FREE(entry_memory);
-        } else {
-            // @TODO error
+            u32 sector_count = filled / HSF_SECTOR_SIZE;
+            for (u32 i = 0; i < sector_count && !stream.error; ++i) {
+                __hsf_stream_sector(&stream, lba + i, chunk + i * HSF_SECTOR_SIZE);
+            }
+            
+            lba += sector_count;
+            
+            // the chunk gets reused for the next read
+            for (u32 i = 0; i < stream.active_count; ++i) __hsf_stream_flush(&stream, stream.active[i]);
         }
+        
+        // anything still outstanding never showed up before the stream ended
+        int result = (stream.error || stream.missed || !stream.found_pvd || stream.pending_count || stream.active_count) ? -1 : 0;
+        
+        for (u32 i = 0; i < stream.pending_count; ++i) __hsf_stream_free_extent(&stream, stream.pending[i]);
+        for (u32 i = 0; i < stream.active_count; ++i) __hsf_stream_free_extent(&stream, stream.active[i]);
+        if (stream.pending) HSF_FREE(stream.pending);
+        if (stream.active) HSF_FREE(stream.active);
+        if (stream.completed) HSF_FREE(stream.completed);
+        while (stream.held_count) HSF_FREE(__hsf_stream_take_oldest(&stream));
+        __hsf_key_set_free(&stream.delivered);
+        if (stream.held) HSF_FREE(stream.held);
+        if (stream.held_lba) HSF_FREE(stream.held_lba);
+        HSF_FREE(chunk);
+        
+        return result;
     }
     
 #ifdef __cplusplus
@@ -90,6 +90,7 @@
 #define OSX_VK_PERIOD    47
 #define OSX_VK_FWD_SLASH 44
 
+#define OSX_VK_FUNCTION  63 // fn, reported as a modifier flag
 #define OSX_VK_CONTROL   59
 #define OSX_VK_OPTION    58
 #define OSX_VK_COMMAND   55
@@ -129,4 +130,481 @@
 #define OSX_VK_NUMPAD_0      82
 #define OSX_VK_NUMPAD_PERIOD 65
 
+// translation tables
+//
+// Dense lookup tables indexed by keycode, so translating is a single array load.
+// A VK that has no define above maps to 0 (HID "no event", Linux KEY_RESERVED)
+// and an empty name. FUNCTION has a name but maps to 0 too: fn is an Apple
+// vendor-page usage in HID and KEY_FN doesn't fit the 256 entry reverse table.
+// The reverse tables map anything without a VK to OSX_VK_NONE. HID usages are
+// from the keyboard/keypad page (0x07), Linux keys are the KEY_* values from
+// linux/input-event-codes.h. They're constexpr in C++11 and up, plain static
+// const arrays in C.
+
+#define OSX_VK_NONE 255
+
+#if (defined(__cplusplus) && __cplusplus >= 201103L) || (defined(_MSVC_LANG) && _MSVC_LANG >= 201103L)
+#define OSX_VK_TABLE static constexpr
+#else
+#define OSX_VK_TABLE static const
+#endif
+
+OSX_VK_TABLE unsigned char osx_vk_to_hid_usage[128] = {
+    0x04,    //   0 A
+    0x16,    //   1 S
+    0x07,    //   2 D
+    0x09,    //   3 F
+    0x0B,    //   4 H
+    0x0A,    //   5 G
+    0x1D,    //   6 Z
+    0x1B,    //   7 X
+    0x06,    //   8 C
+    0x19,    //   9 V
+    0,       //  10
+    0x05,    //  11 B
+    0x14,    //  12 Q
+    0x1A,    //  13 W
+    0x08,    //  14 E
+    0x15,    //  15 R
+    0x1C,    //  16 Y
+    0x17,    //  17 T
+    0x1E,    //  18 1
+    0x1F,    //  19 2
+    0x20,    //  20 3
+    0x21,    //  21 4
+    0x23,    //  22 6
+    0x22,    //  23 5
+    0x2E,    //  24 EQUAL
+    0x26,    //  25 9
+    0x24,    //  26 7
+    0x2D,    //  27 DASH
+    0x25,    //  28 8
+    0x27,    //  29 0
+    0x30,    //  30 RBRACKET
+    0x12,    //  31 O
+    0x18,    //  32 U
+    0x2F,    //  33 LBRACKET
+    0x0C,    //  34 I
+    0x13,    //  35 P
+    0x28,    //  36 RETURN
+    0x0F,    //  37 L
+    0x0D,    //  38 J
+    0x34,    //  39 QUOTE
+    0x0E,    //  40 K
+    0x33,    //  41 COLON
+    0x31,    //  42 BACKSLASH
+    0x36,    //  43 COMMA
+    0x38,    //  44 FWD_SLASH
+    0x11,    //  45 N
+    0x10,    //  46 M
+    0x37,    //  47 PERIOD
+    0x2B,    //  48 TAB
+    0x2C,    //  49 SPACEBAR
+    0x35,    //  50 BACK_TICK
+    0x2A,    //  51 BACKSPACE
+    0,       //  52
+    0x29,    //  53 ESCAPE
+    0,       //  54
+    0xE3,    //  55 COMMAND
+    0xE1,    //  56 SHIFT
+    0x39,    //  57 CAPS_LOCK
+    0xE2,    //  58 OPTION
+    0xE0,    //  59 CONTROL
+    0,       //  60
+    0,       //  61
+    0,       //  62
+    0,       //  63 FUNCTION
+    0,       //  64
+    0x63,    //  65 NUMPAD_PERIOD
+    0,       //  66
+    0x55,    //  67 NUMPAD_MULT
+    0,       //  68
+    0x57,    //  69 NUMPAD_PLUS
+    0,       //  70
+    0x53,    //  71 NUMLOCK
+    0,       //  72
+    0,       //  73
+    0,       //  74
+    0x54,    //  75 NUMPAD_DIVIDE
+    0x58,    //  76 NUMPAD_ENTER
+    0,       //  77
+    0x56,    //  78 NUMPAD_MINUS
+    0,       //  79
+    0,       //  80
+    0x67,    //  81 NUMPAD_EQUALS
+    0x62,    //  82 NUMPAD_0
+    0x59,    //  83 NUMPAD_1
+    0x5A,    //  84 NUMPAD_2
+    0x5B,    //  85 NUMPAD_3
+    0x5C,    //  86 NUMPAD_4
+    0x5D,    //  87 NUMPAD_5
+    0x5E,    //  88 NUMPAD_6
+    0x5F,    //  89 NUMPAD_7
+    0,       //  90
+    0x60,    //  91 NUMPAD_8
+    0x61,    //  92 NUMPAD_9
+    0,       //  93
+    0,       //  94
+    0,       //  95
+    0x3E,    //  96 F5
+    0x3F,    //  97 F6
+    0x40,    //  98 F7
+    0x3C,    //  99 F3
+    0x41,    // 100 F8
+    0x42,    // 101 F9
+    0,       // 102
+    0x44,    // 103 F11
+    0,       // 104
+    0x68,    // 105 F13
+    0,       // 106
+    0x69,    // 107 F14
+    0,       // 108
+    0x43,    // 109 F10
+    0,       // 110
+    0x45,    // 111 F12
+    0,       // 112
+    0x6A,    // 113 F15
+    0x49,    // 114 INSERT
+    0x4A,    // 115 HOME
+    0x4B,    // 116 PAGE_UP
+    0x4C,    // 117 DELETE
+    0x3D,    // 118 F4
+    0x4D,    // 119 END
+    0x3B,    // 120 F2
+    0x4E,    // 121 PAGE_DOWN
+    0x3A,    // 122 F1
+    0x50,    // 123 LEFT
+    0x4F,    // 124 RIGHT
+    0x51,    // 125 DOWN
+    0x52,    // 126 UP
+    0,       // 127
+};
+
+OSX_VK_TABLE unsigned short osx_vk_to_linux_key[128] = {
+    30,      //   0 A
+    31,      //   1 S
+    32,      //   2 D
+    33,      //   3 F
+    35,      //   4 H
+    34,      //   5 G
+    44,      //   6 Z
+    45,      //   7 X
+    46,      //   8 C
+    47,      //   9 V
+    0,       //  10
+    48,      //  11 B
+    16,      //  12 Q
+    17,      //  13 W
+    18,      //  14 E
+    19,      //  15 R
+    21,      //  16 Y
+    20,      //  17 T
+    2,       //  18 1
+    3,       //  19 2
+    4,       //  20 3
+    5,       //  21 4
+    7,       //  22 6
+    6,       //  23 5
+    13,      //  24 EQUAL
+    10,      //  25 9
+    8,       //  26 7
+    12,      //  27 DASH
+    9,       //  28 8
+    11,      //  29 0
+    27,      //  30 RBRACKET
+    24,      //  31 O
+    22,      //  32 U
+    26,      //  33 LBRACKET
+    23,      //  34 I
+    25,      //  35 P
+    28,      //  36 RETURN
+    38,      //  37 L
+    36,      //  38 J
+    40,      //  39 QUOTE
+    37,      //  40 K
+    39,      //  41 COLON
+    43,      //  42 BACKSLASH
+    51,      //  43 COMMA
+    53,      //  44 FWD_SLASH
+    49,      //  45 N
+    50,      //  46 M
+    52,      //  47 PERIOD
+    15,      //  48 TAB
+    57,      //  49 SPACEBAR
+    41,      //  50 BACK_TICK
+    14,      //  51 BACKSPACE
+    0,       //  52
+    1,       //  53 ESCAPE
+    0,       //  54
+    125,     //  55 COMMAND
+    42,      //  56 SHIFT
+    58,      //  57 CAPS_LOCK
+    56,      //  58 OPTION
+    29,      //  59 CONTROL
+    0,       //  60
+    0,       //  61
+    0,       //  62
+    0,       //  63 FUNCTION
+    0,       //  64
+    83,      //  65 NUMPAD_PERIOD
+    0,       //  66
+    55,      //  67 NUMPAD_MULT
+    0,       //  68
+    78,      //  69 NUMPAD_PLUS
+    0,       //  70
+    69,      //  71 NUMLOCK
+    0,       //  72
+    0,       //  73
+    0,       //  74
+    98,      //  75 NUMPAD_DIVIDE
+    96,      //  76 NUMPAD_ENTER
+    0,       //  77
+    74,      //  78 NUMPAD_MINUS
+    0,       //  79
+    0,       //  80
+    117,     //  81 NUMPAD_EQUALS
+    82,      //  82 NUMPAD_0
+    79,      //  83 NUMPAD_1
+    80,      //  84 NUMPAD_2
+    81,      //  85 NUMPAD_3
+    75,      //  86 NUMPAD_4
+    76,      //  87 NUMPAD_5
+    77,      //  88 NUMPAD_6
+    71,      //  89 NUMPAD_7
+    0,       //  90
+    72,      //  91 NUMPAD_8
+    73,      //  92 NUMPAD_9
+    0,       //  93
+    0,       //  94
+    0,       //  95
+    63,      //  96 F5
+    64,      //  97 F6
+    65,      //  98 F7
+    61,      //  99 F3
+    66,      // 100 F8
+    67,      // 101 F9
+    0,       // 102
+    87,      // 103 F11
+    0,       // 104
+    183,     // 105 F13
+    0,       // 106
+    184,     // 107 F14
+    0,       // 108
+    68,      // 109 F10
+    0,       // 110
+    88,      // 111 F12
+    0,       // 112
+    185,     // 113 F15
+    110,     // 114 INSERT
+    102,     // 115 HOME
+    104,     // 116 PAGE_UP
+    111,     // 117 DELETE
+    62,      // 118 F4
+    107,     // 119 END
+    60,      // 120 F2
+    109,     // 121 PAGE_DOWN
+    59,      // 122 F1
+    105,     // 123 LEFT
+    106,     // 124 RIGHT
+    108,     // 125 DOWN
+    103,     // 126 UP
+    0,       // 127
+};
+
+OSX_VK_TABLE unsigned char hid_usage_to_osx_vk[256] = {
+    255, 255, 255, 255,   0,  11,   8,   2,  14,   3,   5,   4,  34,  38,  40,  37, // 0x00
+     46,  45,  31,  35,  12,  15,   1,  17,  32,   9,  13,   7,  16,   6,  18,  19, // 0x10
+     20,  21,  23,  22,  26,  28,  25,  29,  36,  53,  51,  48,  49,  27,  24,  33, // 0x20
+     30,  42, 255,  41,  39,  50,  43,  47,  44,  57, 122, 120,  99, 118,  96,  97, // 0x30
+     98, 100, 101, 109, 103, 111, 255, 255, 255, 114, 115, 116, 117, 119, 121, 124, // 0x40
+    123, 125, 126,  71,  75,  67,  78,  69,  76,  83,  84,  85,  86,  87,  88,  89, // 0x50
+     91,  92,  82,  65, 255, 255, 255,  81, 105, 107, 113, 255, 255, 255, 255, 255, // 0x60
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0x70
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0x80
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0x90
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xA0
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xB0
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xC0
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xD0
+     59,  56,  58,  55, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xE0
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xF0
+};
+
+OSX_VK_TABLE unsigned char linux_key_to_osx_vk[256] = {
+    255,  53,  18,  19,  20,  21,  23,  22,  26,  28,  25,  29,  27,  24,  51,  48, // 0x00
+     12,  13,  14,  15,  17,  16,  32,  34,  31,  35,  33,  30,  36,  59,   0,   1, // 0x10
+      2,   3,   5,   4,  38,  40,  37,  41,  39,  50,  56,  42,   6,   7,   8,   9, // 0x20
+     11,  45,  46,  43,  47,  44, 255,  67,  58,  49,  57, 122, 120,  99, 118,  96, // 0x30
+     97,  98, 100, 101, 109,  71, 255,  89,  91,  92,  78,  86,  87,  88,  69,  83, // 0x40
+     84,  85,  82,  65, 255, 255, 255, 103, 111, 255, 255, 255, 255, 255, 255, 255, // 0x50
+     76, 255,  75, 255, 255, 255, 115, 126, 116, 123, 124, 119, 125, 121, 114, 117, // 0x60
+    255, 255, 255, 255, 255,  81, 255, 255, 255, 255, 255, 255, 255,  55, 255, 255, // 0x70
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0x80
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0x90
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xA0
+    255, 255, 255, 255, 255, 255, 255, 105, 107, 113, 255, 255, 255, 255, 255, 255, // 0xB0
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xC0
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xD0
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xE0
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, // 0xF0
+};
+
+OSX_VK_TABLE char osx_vk_names[128][16] = {
+    "A",
+    "S",
+    "D",
+    "F",
+    "H",
+    "G",
+    "Z",
+    "X",
+    "C",
+    "V",
+    "",
+    "B",
+    "Q",
+    "W",
+    "E",
+    "R",
+    "Y",
+    "T",
+    "1",
+    "2",
+    "3",
+    "4",
+    "6",
+    "5",
+    "EQUAL",
+    "9",
+    "7",
+    "DASH",
+    "8",
+    "0",
+    "RBRACKET",
+    "O",
+    "U",
+    "LBRACKET",
+    "I",
+    "P",
+    "RETURN",
+    "L",
+    "J",
+    "QUOTE",
+    "K",
+    "COLON",
+    "BACKSLASH",
+    "COMMA",
+    "FWD_SLASH",
+    "N",
+    "M",
+    "PERIOD",
+    "TAB",
+    "SPACEBAR",
+    "BACK_TICK",
+    "BACKSPACE",
+    "",
+    "ESCAPE",
+    "",
+    "COMMAND",
+    "SHIFT",
+    "CAPS_LOCK",
+    "OPTION",
+    "CONTROL",
+    "",
+    "",
+    "",
+    "FUNCTION",
+    "",
+    "NUMPAD_PERIOD",
+    "",
+    "NUMPAD_MULT",
+    "",
+    "NUMPAD_PLUS",
+    "",
+    "NUMLOCK",
+    "",
+    "",
+    "",
+    "NUMPAD_DIVIDE",
+    "NUMPAD_ENTER",
+    "",
+    "NUMPAD_MINUS",
+    "",
+    "",
+    "NUMPAD_EQUALS",
+    "NUMPAD_0",
+    "NUMPAD_1",
+    "NUMPAD_2",
+    "NUMPAD_3",
+    "NUMPAD_4",
+    "NUMPAD_5",
+    "NUMPAD_6",
+    "NUMPAD_7",
+    "",
+    "NUMPAD_8",
+    "NUMPAD_9",
+    "",
+    "",
+    "",
+    "F5",
+    "F6",
+    "F7",
+    "F3",
+    "F8",
+    "F9",
+    "",
+    "F11",
+    "",
+    "F13",
+    "",
+    "F14",
+    "",
+    "F10",
+    "",
+    "F12",
+    "",
+    "F15",
+    "INSERT",
+    "HOME",
+    "PAGE_UP",
+    "DELETE",
+    "F4",
+    "END",
+    "F2",
+    "PAGE_DOWN",
+    "F1",
+    "LEFT",
+    "RIGHT",
+    "DOWN",
+    "UP",
+    "",
+};
+
+#if (defined(__cplusplus) && __cplusplus >= 201402L) || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L)
+// every mapping has to survive the trip there and back
+constexpr bool osx_vk__hid_round_trips() {
+    for (int vk = 0; vk < 128; ++vk) {
+        if (osx_vk_to_hid_usage[vk] && hid_usage_to_osx_vk[osx_vk_to_hid_usage[vk]] != vk) return false;
+    }
+    for (int usage = 0; usage < 256; ++usage) {
+        if (hid_usage_to_osx_vk[usage] != OSX_VK_NONE && osx_vk_to_hid_usage[hid_usage_to_osx_vk[usage]] != usage) return false;
+    }
+    return true;
+}
+
+constexpr bool osx_vk__linux_round_trips() {
+    for (int vk = 0; vk < 128; ++vk) {
+        if (osx_vk_to_linux_key[vk] && linux_key_to_osx_vk[osx_vk_to_linux_key[vk]] != vk) return false;
+    }
+    for (int key = 0; key < 256; ++key) {
+        if (linux_key_to_osx_vk[key] != OSX_VK_NONE && osx_vk_to_linux_key[linux_key_to_osx_vk[key]] != key) return false;
+    }
+    return true;
+}
+
+static_assert(osx_vk__hid_round_trips(), "osx_vk_to_hid_usage and hid_usage_to_osx_vk disagree");
+static_assert(osx_vk__linux_round_trips(), "osx_vk_to_linux_key and linux_key_to_osx_vk disagree");
+static_assert(osx_vk_to_hid_usage[OSX_VK_A] == 0x04 && osx_vk_to_linux_key[OSX_VK_A] == 30, "tables are out of order");
+#endif
+
 #endif // OSX_VK_CODES_H
@@ -0,0 +1,223 @@
+// osx_vk_state.h - public domain
+// Keyboard state as a 128-bit set indexed by the OSX_VK_* codes from
+// osx_vk_codes.h, plus hotkey chords that can be tested against that state in
+// bulk. A chord is a set of keys that must be held and a set of keys whose
+// state matters, so testing one is an AND and a compare; on SSE2 and NEON
+// that's a couple of vector ops per chord instead of walking key lists.
+// Everything is static inline, include it wherever you need it.
+
+// This software is dual-licensed to the public domain and under the following
+// license: you are granted a perpetual, irrevocable license to copy, modify,
+// publish, and distribute this file as you see fit.
+
+#ifndef OSX_VK_STATE_H
+#define OSX_VK_STATE_H
+
+#include <stdint.h>
+#include "osx_vk_codes.h"
+
+#if !defined(OSX_VK_STATE_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OSX_VK_STATE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define OSX_VK_STATE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint64_t bits[2]; // vk 0-63, vk 64-127
+} Osx_Vk_State;
+
+typedef struct {
+    Osx_Vk_State keys; // keys that have to be down
+    Osx_Vk_State care; // keys that are compared, always a superset of keys
+} Osx_Vk_Chord;
+
+// vk codes from 128 up, like OSX_VK_NONE, have no bit and are ignored
+
+typedef struct {
+    uint8_t vk;
+    uint8_t down; // 0 for key up, anything else for key down
+} Osx_Vk_Event;
+
+// called with the index of the event that completed the chord and the chord's
+// index in the array passed to osx_vk_state_apply_and_match
+typedef void (*osx_vk_chord_callback)(uint32_t event_index, uint32_t chord_index, void *payload);
+
+// modifier masks
+//
+// OSX_VK_STATE_INIT builds a constant state with up to five keys set, unused
+// slots are OSX_VK_NONE which doesn't land in either word.
+
+#define OSX_VK_STATE_WORD(vk, word) ((((vk) >> 6) == (word)) ? ((uint64_t)1 << ((vk) & 63)) : 0)
+#define OSX_VK_STATE_WORD5(a, b, c, d, e, word) (OSX_VK_STATE_WORD(a, word) | OSX_VK_STATE_WORD(b, word) | OSX_VK_STATE_WORD(c, word) | OSX_VK_STATE_WORD(d, word) | OSX_VK_STATE_WORD(e, word))
+#define OSX_VK_STATE_INIT(a, b, c, d, e) { { OSX_VK_STATE_WORD5(a, b, c, d, e, 0), OSX_VK_STATE_WORD5(a, b, c, d, e, 1) } }
+
+static const Osx_Vk_State osx_vk_command_mask   = OSX_VK_STATE_INIT(OSX_VK_COMMAND, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE);
+static const Osx_Vk_State osx_vk_shift_mask     = OSX_VK_STATE_INIT(OSX_VK_SHIFT, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE);
+static const Osx_Vk_State osx_vk_option_mask    = OSX_VK_STATE_INIT(OSX_VK_OPTION, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE);
+static const Osx_Vk_State osx_vk_control_mask   = OSX_VK_STATE_INIT(OSX_VK_CONTROL, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE);
+static const Osx_Vk_State osx_vk_function_mask  = OSX_VK_STATE_INIT(OSX_VK_FUNCTION, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE, OSX_VK_NONE);
+static const Osx_Vk_State osx_vk_modifiers_mask = OSX_VK_STATE_INIT(OSX_VK_COMMAND, OSX_VK_SHIFT, OSX_VK_OPTION, OSX_VK_CONTROL, OSX_VK_FUNCTION);
+
+// state
+
+static inline void osx_vk_state_clear(Osx_Vk_State *state) {
+    state->bits[0] = 0;
+    state->bits[1] = 0;
+}
+
+static inline void osx_vk_state_set(Osx_Vk_State *state, uint8_t vk, int down) {
+    if (vk >= 128) return;
+
+    uint64_t bit = (uint64_t)1 << (vk & 63);
+    uint64_t set = (uint64_t)0 - (uint64_t)(down != 0);
+    uint64_t *word = &state->bits[(vk >> 6) & 1];
+
+    *word = (*word & ~bit) | (bit & set);
+}
+
+static inline int osx_vk_state_is_down(const Osx_Vk_State *state, uint8_t vk) {
+    if (vk >= 128) return 0;
+    return (int)((state->bits[(vk >> 6) & 1] >> (vk & 63)) & 1);
+}
+
+// true if any key in mask is down, e.g. osx_vk_state_any(&state, &osx_vk_modifiers_mask)
+static inline int osx_vk_state_any(const Osx_Vk_State *state, const Osx_Vk_State *mask) {
+    return ((state->bits[0] & mask->bits[0]) | (state->bits[1] & mask->bits[1])) != 0;
+}
+
+// applies events in order, later events for the same key win
+static inline void osx_vk_state_apply(Osx_Vk_State *state, const Osx_Vk_Event *events, uint32_t count) {
+    uint64_t lo = state->bits[0];
+    uint64_t hi = state->bits[1];
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint8_t vk = events[i].vk;
+        uint64_t bit = ((uint64_t)1 << (vk & 63)) & ((uint64_t)0 - (uint64_t)(vk < 128));
+        uint64_t set = (uint64_t)0 - (uint64_t)(events[i].down != 0);
+        uint64_t in_hi = (uint64_t)0 - (uint64_t)((vk >> 6) & 1);
+        uint64_t lo_bit = bit & ~in_hi;
+        uint64_t hi_bit = bit & in_hi;
+
+        lo = (lo & ~lo_bit) | (lo_bit & set);
+        hi = (hi & ~hi_bit) | (hi_bit & set);
+    }
+
+    state->bits[0] = lo;
+    state->bits[1] = hi;
+}
+
+// chords
+
+// exact chord: the listed keys are down and no other modifier is, so
+// Command+C doesn't fire while Command+Shift+C is held. Other non-modifier keys
+// are ignored. Widen or narrow chord->care afterwards for other policies.
+static inline Osx_Vk_Chord osx_vk_chord_make(const uint8_t *vks, uint32_t count) {
+    Osx_Vk_Chord chord;
+
+    osx_vk_state_clear(&chord.keys);
+    for (uint32_t i = 0; i < count; ++i) {
+        osx_vk_state_set(&chord.keys, vks[i], 1);
+    }
+
+    chord.care.bits[0] = chord.keys.bits[0] | osx_vk_modifiers_mask.bits[0];
+    chord.care.bits[1] = chord.keys.bits[1] | osx_vk_modifiers_mask.bits[1];
+    return chord;
+}
+
+static inline int osx_vk_chord_held(const Osx_Vk_Chord *chord, const Osx_Vk_State *state) {
+#if defined(OSX_VK_STATE_SSE2)
+    __m128i s = _mm_loadu_si128((const __m128i *)state);
+    __m128i k = _mm_loadu_si128((const __m128i *)&chord->keys);
+    __m128i c = _mm_loadu_si128((const __m128i *)&chord->care);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(s, c), k)) == 0xFFFF;
+#elif defined(OSX_VK_STATE_NEON)
+    uint64x2_t s = vld1q_u64(state->bits);
+    uint64x2_t diff = veorq_u64(vandq_u64(s, vld1q_u64(chord->care.bits)), vld1q_u64(chord->keys.bits));
+    return (vgetq_lane_u64(diff, 0) | vgetq_lane_u64(diff, 1)) == 0;
+#else
+    return (((state->bits[0] & chord->care.bits[0]) ^ chord->keys.bits[0]) |
+            ((state->bits[1] & chord->care.bits[1]) ^ chord->keys.bits[1])) == 0;
+#endif
+}
+
+// tests every chord against state. Bit (i & 63) of matches[i >> 6] is set if
+// chords[i] is held, matches needs (chord_count + 63) / 64 words. Returns the
+// number of chords that are held.
+static inline uint32_t osx_vk_chords_match(const Osx_Vk_Chord *chords, uint32_t chord_count, const Osx_Vk_State *state, uint64_t *matches) {
+    uint32_t held = 0;
+    uint32_t i = 0;
+
+    for (uint32_t w = 0; w < (chord_count + 63) / 64; ++w) matches[w] = 0;
+
+#if defined(OSX_VK_STATE_SSE2)
+    __m128i s = _mm_loadu_si128((const __m128i *)state);
+
+    // four chords per pass, one movemask for all of them
+    for (; i + 4 <= chord_count; i += 4) {
+        const __m128i *c = (const __m128i *)&chords[i];
+        __m128i e0 = _mm_cmpeq_epi8(_mm_and_si128(s, _mm_loadu_si128(c + 1)), _mm_loadu_si128(c + 0));
+        __m128i e1 = _mm_cmpeq_epi8(_mm_and_si128(s, _mm_loadu_si128(c + 3)), _mm_loadu_si128(c + 2));
+        __m128i e2 = _mm_cmpeq_epi8(_mm_and_si128(s, _mm_loadu_si128(c + 5)), _mm_loadu_si128(c + 4));
+        __m128i e3 = _mm_cmpeq_epi8(_mm_and_si128(s, _mm_loadu_si128(c + 7)), _mm_loadu_si128(c + 6));
+
+        // an equal byte is 0xFF, packing keeps that as -1 and anything else
+        // not -1, so each chord narrows to four bytes of one lane
+        __m128i p01 = _mm_packs_epi16(_mm_packs_epi16(e0, e1), _mm_setzero_si128());
+        __m128i p23 = _mm_packs_epi16(_mm_packs_epi16(e2, e3), _mm_setzero_si128());
+        __m128i all = _mm_unpacklo_epi64(p01, p23);
+        all = _mm_cmpeq_epi32(all, _mm_set1_epi32(-1));
+        uint32_t bits = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(all));
+
+        matches[i >> 6] |= (uint64_t)bits << (i & 63);
+        held += (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + (bits >> 3);
+    }
+#endif
+
+    for (; i < chord_count; ++i) {
+        uint64_t hit = (uint64_t)osx_vk_chord_held(&chords[i], state);
+        matches[i >> 6] |= hit << (i & 63);
+        held += (uint32_t)hit;
+    }
+
+    return held;
+}
+
+// replays events into state and reports each chord that becomes held on a key
+// down, chords that stay held across later events aren't reported again
+static inline void osx_vk_state_apply_and_match(Osx_Vk_State *state, const Osx_Vk_Event *events, uint32_t count,
+                                                const Osx_Vk_Chord *chords, uint32_t chord_count,
+                                                osx_vk_chord_callback callback, void *payload) {
+    for (uint32_t i = 0; i < count; ++i) {
+        uint8_t vk = events[i].vk;
+        int was_down = osx_vk_state_is_down(state, vk);
+
+        osx_vk_state_set(state, vk, events[i].down);
+        if (!events[i].down || was_down || vk >= 128) continue; // releases and key repeat
+
+        // batch test 64 chords at a time, hits are rare so they get the scalar check
+        for (uint32_t base = 0; base < chord_count; base += 64) {
+            uint32_t n = (chord_count - base < 64) ? chord_count - base : 64;
+            uint64_t hits;
+
+            if (!osx_vk_chords_match(chords + base, n, state, &hits)) continue;
+            for (uint32_t b = 0; hits; ++b, hits >>= 1) {
+                // only chords that involve this key can have just become held
+                if ((hits & 1) && osx_vk_state_is_down(&chords[base + b].keys, vk)) callback(i, base + b, payload);
+            }
+        }
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OSX_VK_STATE_H